@@ -1,6 +1,13 @@
 #include "mempool.h"
 
 #include <Arduino.h>
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#elif defined(__has_include)
+#if __has_include(<sys/mman.h>)
+#include <sys/mman.h>
+#endif
+#endif
 
 #define SEGMENT_STEP 4  ///< Step size for segment allocation in bytes (must be a power of 2).
 #define SEGMENT_LOG2 2  ///< Log2 of segment step for size calculations (must satisfy SEGMENT_STEP == 1 << SEGMENT_LOG2).
@@ -17,24 +24,104 @@ mempool::~mempool() {
 }
 
 void mempool::clean() {
+  if (_initialized) mempool_unregister_pool(this);
+  if (_buddy_buffer) {
+    _buddy.clean();
+    _regions[_buddy_region].provider.free(_buddy_buffer, _regions[_buddy_region].provider.ctx);
+    _buddy_buffer = nullptr;
+  }
+  if (_tlsf_buffer) {
+    _tlsf.clean();
+    _regions[_tlsf_region].provider.free(_tlsf_buffer, _regions[_tlsf_region].provider.ctx);
+    _tlsf_buffer = nullptr;
+  }
+  if (_slabs) {
+    for (uint8_t i = 0; i < _segment_count; i++) {
+      while (_slabs[i]) {
+        mempool_slab* s = _slabs[i];
+        _slabs[i] = s->next;
+        s->free(s, s->ctx);
+      }
+    }
+    delete[] _slabs;
+  }
+  while (_spare) {
+    mempool_slab* s = _spare;
+    _spare = s->next;
+    s->free(s, s->ctx);
+  }
+  _spare_count = 0;
+  if (_grow_count) delete[] _grow_count;
+  if (_grow_slabs) delete[] _grow_slabs;
+  if (_slab_count) delete[] _slab_count;
   if (_segment_sizes) delete[] _segment_sizes;
   if (_cell_count) delete[] _cell_count;
   if (_magic_number) delete[] _magic_number;
   if (_segment_shift) delete[] _segment_shift;
-  if (_buffer) delete[] _buffer;
+  if (_region_buffer) {
+    for (uint8_t i = 0; i < _region_count; i++) {
+      if (_region_buffer[i]) _regions[i].provider.free(_region_buffer[i], _regions[i].provider.ctx);
+    }
+    delete[] _region_buffer;
+  }
+  if (_region_size) delete[] _region_size;
+  if (_regions) delete[] _regions;
+  if (_segment_region) delete[] _segment_region;
+  if (_segment_order) delete[] _segment_order;
+  if (_segment_engine) delete[] _segment_engine;
+  if (_free_head) delete[] _free_head;
+  if (_cursor) delete[] _cursor;
   if (_pool_buffer) delete[] _pool_buffer;
   if (_segment_lookup) delete[] _segment_lookup;
   if (_segment_ptr) delete[] _segment_ptr;
   if (_pool_ptr) delete[] _pool_ptr;
+  if (_refs_buffer) delete[] _refs_buffer;
+  if (_refs_ptr) delete[] _refs_ptr;
+  _refs_buffer = nullptr;
+  _refs_ptr = nullptr;
 #ifdef MEMPOOL_STATISTIC
   if (_max_cells_used) delete[] _max_cells_used;
   if (_allocs_per_segment) delete[] _allocs_per_segment;
+  if (_spills_per_segment) delete[] _spills_per_segment;
+  if (_cells_used) delete[] _cells_used;
+  _max_cells_used = nullptr;
+  _allocs_per_segment = nullptr;
+  _spills_per_segment = nullptr;
+  _cells_used = nullptr;
 #endif
+  _slabs = nullptr;
+  _grow_count = nullptr;
+  _grow_slabs = nullptr;
+  _slab_count = nullptr;
+  _segment_sizes = nullptr;
+  _cell_count = nullptr;
+  _magic_number = nullptr;
+  _segment_shift = nullptr;
+  _region_buffer = nullptr;
+  _region_size = nullptr;
+  _regions = nullptr;
+  _segment_region = nullptr;
+  _segment_order = nullptr;
+  _segment_engine = nullptr;
+  _free_head = nullptr;
+  _cursor = nullptr;
+  _region_count = 0;
+  _custom_regions = false;
+  _pool_buffer = nullptr;
+  _segment_lookup = nullptr;
+  _segment_ptr = nullptr;
+  _pool_ptr = nullptr;
+  _pool_size = 0;
+  _grown_bytes = 0;
+  _segment_count = 0;
+  _max_segment_size = 0;
+  _initialized = false;
 }
 
-bool mempool::begin(segment* segs, uint8_t count) {
+bool mempool::begin(segment* segs, uint8_t count, const mempool_region* regions, uint8_t region_count) {
   if (_initialized) return false;
-  if (count > 64) return false;
+  if (count == 0 || count > 64) return false;
+  if (regions && region_count == 0) return false;
 
   // Allocate arrays with nullptr checks
   _segment_sizes = new uint16_t[count];
@@ -62,11 +149,72 @@ bool mempool::begin(segment* segs, uint8_t count) {
     clean();
     return false;
   }
-  _pool_ptr = new uint32_t* [count] {};
+  _pool_ptr = new mempool_word* [count] {};
   if (!_pool_ptr) {
     clean();
     return false;
   }
+  _slabs = new mempool_slab* [count] {};
+  if (!_slabs) {
+    clean();
+    return false;
+  }
+  _grow_count = new uint16_t[count]{};
+  if (!_grow_count) {
+    clean();
+    return false;
+  }
+  _grow_slabs = new uint8_t[count]{};
+  if (!_grow_slabs) {
+    clean();
+    return false;
+  }
+  _slab_count = new uint8_t[count]{};
+  if (!_slab_count) {
+    clean();
+    return false;
+  }
+  _segment_region = new uint8_t[count]{};
+  if (!_segment_region) {
+    clean();
+    return false;
+  }
+  _segment_order = new uint8_t[count];
+  if (!_segment_order) {
+    clean();
+    return false;
+  }
+  _segment_engine = new segment_engine[count]{};
+  if (!_segment_engine) {
+    clean();
+    return false;
+  }
+  _free_head = new uint16_t[count];
+  if (!_free_head) {
+    clean();
+    return false;
+  }
+  _cursor = new uint16_t[count]{};
+  if (!_cursor) {
+    clean();
+    return false;
+  }
+  _region_count = regions ? region_count : 1;
+  _regions = new mempool_region[_region_count];
+  if (!_regions) {
+    clean();
+    return false;
+  }
+  _region_buffer = new uint8_t* [_region_count] {};
+  if (!_region_buffer) {
+    clean();
+    return false;
+  }
+  _region_size = new uint32_t[_region_count]{};
+  if (!_region_size) {
+    clean();
+    return false;
+  }
 #ifdef MEMPOOL_STATISTIC
   _max_cells_used = new uint16_t[count]{};
   if (!_max_cells_used) {
@@ -78,10 +226,28 @@ bool mempool::begin(segment* segs, uint8_t count) {
     clean();
     return false;
   }
+  _spills_per_segment = new uint32_t[count]{};
+  if (!_spills_per_segment) {
+    clean();
+    return false;
+  }
+  _cells_used = new uint16_t[count]{};
+  if (!_cells_used) {
+    clean();
+    return false;
+  }
 #endif
   _initialized = true;
   _segment_count = count;
-  _buffer_size = 0;
+  _custom_regions = regions != nullptr;
+  for (uint8_t r = 0; r < _region_count; r++) {
+    // Without a region table all segments share one zeroed block from the system heap
+    _regions[r] = regions ? regions[r] : mempool_region{{mempool_malloc, mempool_free, nullptr}, 0};
+    if (!_regions[r].provider.alloc || !_regions[r].provider.free) {
+      clean();
+      return false;
+    }
+  }
 
   uint8_t ix;
   uint16_t currentSize = 0;
@@ -98,21 +264,38 @@ bool mempool::begin(segment* segs, uint8_t count) {
       return false;
     }
     _cell_count[i] = segs[ix].count;
+    _grow_count[i] = segs[ix].grow_count;
+    _grow_slabs[i] = segs[ix].grow_slabs;
+    _segment_region[i] = regions ? segs[ix].region : 0;
+    _segment_engine[i] = segs[ix].engine;
+    if (_cell_count[i] == MEMPOOL_NO_CELL || _grow_count[i] == MEMPOOL_NO_CELL) {  // Reserved as free list terminator
+      clean();
+      return false;
+    }
+    if (_segment_region[i] >= _region_count) {
+      clean();
+      return false;
+    }
 
     currentSize = segs[ix].size;
-    _buffer_size += _segment_sizes[i] * _cell_count[i];  // Data buffer size
-    _pool_size += (_cell_count[i] + 31) / 32;            // Pool mask size
-    _pool_size++;                                        // Pool header mask
+    _region_size[_segment_region[i]] += _align_up(_segment_sizes[i] * _cell_count[i]);  // Data buffer size
+    _pool_size += mempool_bits::words(_cell_count[i]);                       // Pool mask size
+    _pool_size += mempool_bits::headers(_cell_count[i]);                     // Pool header masks
   }
 
   _max_segment_size = _segment_sizes[count - 1];
 
-  _buffer = new uint8_t[_buffer_size]{};
-  if (!_buffer) {
-    clean();
-    return false;
+  for (uint8_t r = 0; r < _region_count; r++) {
+    if (_region_size[r] == 0) continue;
+    _region_size[r] += MEMPOOL_ALIGN - 1;  // Slack for aligning the first segment
+    _region_buffer[r] = static_cast<uint8_t*>(_regions[r].provider.alloc(_region_size[r], _regions[r].provider.ctx));
+    if (!_region_buffer[r]) {
+      clean();
+      return false;
+    }
+    memset(_region_buffer[r], 0, _region_size[r]);
   }
-  _pool_buffer = new uint32_t[_pool_size]{};
+  _pool_buffer = new mempool_word[_pool_size]{};
   if (!_pool_buffer) {
     clean();
     return false;
@@ -129,20 +312,37 @@ bool mempool::begin(segment* segs, uint8_t count) {
     _segment_lookup[i - 1] = _lookup_segment(i * SEGMENT_STEP);
   }
 
-  // Initialize segment and pool pointers
-  _segment_ptr[0] = _buffer;
+  // Initialize segment and pool pointers, segments of a region are laid out by increasing size
   _pool_ptr[0] = _pool_buffer;
   for (uint8_t i = 0; i < count - 1; ++i) {
-    _segment_ptr[i + 1] = _segment_ptr[i] + _segment_sizes[i] * _cell_count[i];
-    _pool_ptr[i + 1] = _pool_ptr[i] + (_cell_count[i] + 31) / 32 + 1;
+    _pool_ptr[i + 1] = _pool_ptr[i] + mempool_bits::headers(_cell_count[i]) + mempool_bits::words(_cell_count[i]);
+  }
+  for (uint8_t r = 0; r < _region_count; r++) {
+    // Segments start at MEMPOOL_ALIGN boundaries, so cells are aligned to their size up to MEMPOOL_ALIGN
+    uint8_t* p = _align_ptr(_region_buffer[r]);
+    for (uint8_t i = 0; i < count; ++i) {
+      if (_segment_region[i] != r) continue;
+      _segment_ptr[i] = p;
+      p += _align_up(_segment_sizes[i] * _cell_count[i]);
+    }
+  }
+
+  // Sort segments by address for the binary search in release (empty segments before their neighbour)
+  for (uint8_t i = 0; i < count; ++i) {
+    uint8_t j = i;
+    while (j > 0 && _segment_before(i, _segment_order[j - 1])) {
+      _segment_order[j] = _segment_order[j - 1];
+      j--;
+    }
+    _segment_order[j] = i;
   }
 
   // Initialize magic numbers and shifts for fast division
   for (uint8_t i = 0; i < count; ++i) {
     if (_segment_sizes[i] & (_segment_sizes[i] - 1)) {
       // Non-power-of-2 sizes use magic number for fast division
-      _magic_number[i] = (65536 + (_segment_sizes[i] >> 2) - 1) / (_segment_sizes[i] >> 2);
-      _segment_shift[i] = 16;
+      _magic_number[i] = (0xFFFFFFFF + static_cast<uint64_t>(_segment_sizes[i] >> 2)) / (_segment_sizes[i] >> 2);
+      _segment_shift[i] = 32;
     } else {
       // Power-of-2 sizes use bit shift for fast division
       _magic_number[i] = 1;
@@ -152,12 +352,44 @@ bool mempool::begin(segment* segs, uint8_t count) {
 
   // Initialize pool masks (0 bits indicate free cells)
   for (uint8_t i = 0; i < count; i++) {
-    _pool_ptr[i][0] = _prepare_mask((_cell_count[i] + 31) / 32);
-    _pool_ptr[i][(_cell_count[i] + 31) / 32] = _prepare_mask(_cell_count[i] % 32);
+    _init_masks(_pool_ptr[i], _cell_count[i]);
+    _init_free_list(i, _segment_ptr[i], _cell_count[i], _free_head[i]);
+  }
+
+  // Let mempool_release_any route cells back to this pool
+  for (uint8_t r = 0; r < _region_count; r++) {
+    if (_region_buffer[r] && !mempool_register(this, _region_buffer[r], _region_size[r])) {
+      clean();
+      return false;
+    }
   }
   return true;
 }
 
+bool mempool::_segment_before(uint8_t a, uint8_t b) {
+  if (_segment_ptr[a] != _segment_ptr[b]) return _segment_ptr[a] < _segment_ptr[b];
+  return _cell_count[a] == 0 && _cell_count[b] != 0;
+}
+
+int16_t mempool::_find_segment(const uint8_t* ptr) {
+  // Binary search over segments sorted by address (O(log n), efficient for large segment counts)
+  int16_t ix = -1;
+  int16_t l = 0, r = _segment_count - 1;
+  while (l <= r) {
+    int16_t m = (l + r) >> 1;
+    if (ptr < _segment_ptr[_segment_order[m]]) {
+      r = m - 1;
+    } else {
+      ix = m;
+      l = m + 1;
+    }
+  }
+  if (ix == -1) return -1;
+  uint8_t sg = _segment_order[ix];
+  if (ptr >= _segment_ptr[sg] + _segment_sizes[sg] * _cell_count[sg]) return -1;
+  return sg;
+}
+
 uint8_t mempool::_get_next_segment(segment* arr, uint8_t count, uint16_t current) {
   uint16_t find = -1;
   uint8_t ret = 0;
@@ -177,20 +409,313 @@ int16_t mempool::_lookup_segment(uint16_t size) {
   return -1;
 }
 
-uint32_t mempool::_prepare_mask(uint8_t c) {
-  if (c == 0) return 0;
-  uint32_t ret = 0xFFFFFFFF;
-  ret = ret << c;
-  return ret;
+void mempool::_init_masks(mempool_word* pp, uint16_t count) {
+  uint16_t words = mempool_bits::words(count);
+  uint16_t headers = mempool_bits::headers(count);
+  memset(pp, 0, (headers + words) * sizeof(mempool_word));
+  // Bits past the last cell and past the last cell word stay set so they never look free
+  if (words) pp[headers + words - 1] = mempool_bits::tail_mask(count & (mempool_bits::bits - 1));
+  if (headers) pp[headers - 1] = mempool_bits::tail_mask(words & (mempool_bits::bits - 1));
+}
+
+void mempool::_mark_cell(mempool_word* pp, uint16_t headers, uint16_t cell) {
+  uint16_t word = cell >> mempool_bits::shift;
+  mempool_word* cell_mask = &pp[headers + word];
+  *cell_mask |= static_cast<mempool_word>(1) << (cell & (mempool_bits::bits - 1));
+  if (*cell_mask == mempool_bits::full) {
+    pp[word >> mempool_bits::shift] |= static_cast<mempool_word>(1) << (word & (mempool_bits::bits - 1));
+  }
+}
+
+int32_t mempool::_take_cell(mempool_word* pp, uint16_t count) {
+  uint16_t headers = mempool_bits::headers(count);
+  // Small segments have a single header word, larger ones scan the header words (vectorized on hosts)
+  int32_t h = (headers == 1) ? (*pp == mempool_bits::full ? -1 : 0) : mempool_bits::find_nonfull(pp, 0, headers);
+  if (h < 0) return -1;
+  uint16_t word = (h << mempool_bits::shift) + mempool_bits::ctz(~pp[h]);
+  uint16_t cell = (word << mempool_bits::shift) + mempool_bits::ctz(~pp[headers + word]);
+  _mark_cell(pp, headers, cell);
+  return cell;
+}
+
+int32_t mempool::_take_span(mempool_word* pp, uint16_t count, uint16_t k) {
+  uint16_t words = mempool_bits::words(count);
+  uint16_t headers = mempool_bits::headers(count);
+  mempool_word* cells = pp + headers;
+  uint32_t run = 0;  // Free cells at the top of the words already scanned
+  for (uint16_t w = 0; w < words; w++) {
+    if (!run) {
+      // No run to continue: skip the fully used words, a vector compare at a time on hosts
+      int32_t next = mempool_bits::find_nonfull(cells, w, words);
+      if (next < 0) return -1;
+      w = next;
+    }
+    mempool_word free_bits = ~cells[w];
+    int32_t start = -1;
+    if (run) {
+      // Continue the run from the previous words with the free cells at the bottom of this one
+      uint8_t low = free_bits == mempool_bits::full ? mempool_bits::bits : mempool_bits::ctz(cells[w]);
+      if (run + low >= k) start = ((uint32_t)w << mempool_bits::shift) - run;
+    }
+    if (start < 0 && k <= mempool_bits::bits) {
+      // Bit-parallel search: bit i survives if cells i .. i + k - 1 are all free
+      mempool_word m = free_bits;
+      for (uint16_t len = 1; len < k && m;) {
+        uint16_t step = len < k - len ? len : k - len;
+        m &= m >> step;
+        len += step;
+      }
+      if (m) start = ((uint32_t)w << mempool_bits::shift) + mempool_bits::ctz(m);
+    }
+    if (start >= 0) {
+      _mark_span(pp, headers, start, k);
+      return start;
+    }
+    run = free_bits == mempool_bits::full ? run + mempool_bits::bits : mempool_bits::clz(cells[w]);
+  }
+  return -1;
+}
+
+void mempool::_mark_span(mempool_word* pp, uint16_t headers, uint16_t start, uint16_t k) {
+  uint32_t end = (uint32_t)start + k;
+  for (uint32_t c = start; c < end;) {
+    uint16_t word = c >> mempool_bits::shift;
+    uint8_t b = c & (mempool_bits::bits - 1);
+    uint8_t n = (end - c < (uint32_t)(mempool_bits::bits - b)) ? end - c : mempool_bits::bits - b;
+    mempool_word* cell_mask = &pp[headers + word];
+    *cell_mask |= mempool_bits::range_mask(b, n);
+    if (*cell_mask == mempool_bits::full) {
+      pp[word >> mempool_bits::shift] |= static_cast<mempool_word>(1) << (word & (mempool_bits::bits - 1));
+    }
+    c += n;
+  }
+}
+
+uint32_t mempool::_cell_index(uint8_t sg, uint32_t offset) {
+  if (_segment_sizes[sg] & (_segment_sizes[sg] - 1)) {
+    // Non-power-of-2 sizes use magic number for fast division
+    return (static_cast<uint64_t>(offset >> 2) * _magic_number[sg]) >> 32;
+  }
+  // Power-of-2 sizes use bit shift for fast division
+  return offset >> _segment_shift[sg];
+}
+
+int32_t mempool::_take_next_fit(mempool_word* pp, uint16_t count, uint16_t& cursor) {
+  uint16_t words = mempool_bits::words(count);
+  uint16_t headers = mempool_bits::headers(count);
+  if (words == 0) return -1;
+  uint16_t word = cursor >> mempool_bits::shift;
+  if (word >= words) {
+    word = 0;
+    cursor = 0;
+  }
+
+  // Continue in the cursor's word, then in the next non-full word after it, wrapping around
+  mempool_word free_bits = ~pp[headers + word] & (mempool_bits::full << (cursor & (mempool_bits::bits - 1)));
+  if (!free_bits) {
+    uint16_t h = word >> mempool_bits::shift;
+    uint8_t b = word & (mempool_bits::bits - 1);
+    mempool_word ahead = b < mempool_bits::bits - 1 ? ~pp[h] & (mempool_bits::full << (b + 1)) : 0;
+    if (ahead) {
+      word = (h << mempool_bits::shift) + mempool_bits::ctz(ahead);
+    } else {
+      int32_t next = mempool_bits::find_nonfull(pp, h + 1, headers);
+      if (next < 0) next = mempool_bits::find_nonfull(pp, 0, h + 1);
+      if (next < 0) return -1;
+      word = (next << mempool_bits::shift) + mempool_bits::ctz(~pp[next]);
+    }
+    free_bits = ~pp[headers + word];
+  }
+
+  uint16_t cell = (word << mempool_bits::shift) + mempool_bits::ctz(free_bits);
+  _mark_cell(pp, headers, cell);
+  cursor = cell + 1;
+  return cell;
+}
+
+int32_t mempool::_take(uint8_t sg, uint8_t* data, mempool_word* pp, uint16_t count, uint16_t& head, uint16_t& cursor) {
+  if (_segment_engine[sg] == MEMPOOL_ENGINE_BITMAP) return _take_cell(pp, count);
+  if (_segment_engine[sg] == MEMPOOL_ENGINE_NEXTFIT) return _take_next_fit(pp, count, cursor);
+
+  // Pop the most recently freed cell, the masks are only updated (no scan) to keep them authoritative
+  if (head == MEMPOOL_NO_CELL) return -1;
+  uint16_t cell = head;
+  head = *reinterpret_cast<uint16_t*>(data + cell * _segment_sizes[sg]);
+  _mark_cell(pp, mempool_bits::headers(count), cell);
+  return cell;
+}
+
+bool mempool::_put(uint8_t sg, uint8_t* data, mempool_word* pp, uint16_t count, uint16_t cell, uint16_t& head) {
+  uint16_t word = cell >> mempool_bits::shift;
+  mempool_word* cell_mask = &pp[mempool_bits::headers(count) + word];
+  mempool_word bit = static_cast<mempool_word>(1) << (cell & (mempool_bits::bits - 1));
+  if (!(*cell_mask & bit)) return false;  // Already free
+  *cell_mask &= ~bit;
+  pp[word >> mempool_bits::shift] &= ~(static_cast<mempool_word>(1) << (word & (mempool_bits::bits - 1)));
+  if (_segment_engine[sg] == MEMPOOL_ENGINE_FREELIST) {
+    *reinterpret_cast<uint16_t*>(data + cell * _segment_sizes[sg]) = head;
+    head = cell;
+  }
+  return true;
+}
+
+void mempool::_init_free_list(uint8_t sg, uint8_t* data, uint16_t count, uint16_t& head) {
+  head = MEMPOOL_NO_CELL;
+  if (_segment_engine[sg] != MEMPOOL_ENGINE_FREELIST) return;
+  // Link backwards so the first pops hand out the lowest cells
+  for (uint16_t i = count; i-- > 0;) {
+    *reinterpret_cast<uint16_t*>(data + i * _segment_sizes[sg]) = head;
+    head = i;
+  }
+}
+
+uint8_t* mempool::_take_from_segment(uint8_t sg) {
+  int32_t cell = _take(sg, _segment_ptr[sg], _pool_ptr[sg], _cell_count[sg], _free_head[sg], _cursor[sg]);
+  if (cell >= 0) return _segment_ptr[sg] + cell * _segment_sizes[sg];
+  mempool_slab* s = _slabs[sg];
+  for (; s; s = s->next) {
+    cell = _take(sg, s->data, s->mask, s->count, s->free_head, s->cursor);
+    if (cell >= 0) return s->data + cell * _segment_sizes[sg];
+  }
+  s = _grow(sg);
+  if (!s) return nullptr;
+  cell = _take(sg, s->data, s->mask, s->count, s->free_head, s->cursor);
+  return s->data + cell * _segment_sizes[sg];
+}
+
+mempool_slab* mempool::_grow(uint8_t sg) {
+  uint16_t count = _grow_count[sg];
+  if (count == 0 || _slab_count[sg] >= _grow_slabs[sg]) return nullptr;
+  uint16_t words = mempool_bits::headers(count) + mempool_bits::words(count);
+  uint32_t bytes = sizeof(mempool_slab) + words * sizeof(mempool_word) + MEMPOOL_ALIGN - 1 +
+                   (uint32_t)count * _segment_sizes[sg];
+  if (_refs_buffer) bytes += count;  // Reference counts after the cells
+
+  // Re-carve a spare slab given up by any segment (of the same region) before asking upstream
+  const mempool_upstream* region = _custom_regions ? &_regions[_segment_region[sg]].provider : nullptr;
+  mempool_slab* s = nullptr;
+  for (mempool_slab** sp = &_spare; *sp; sp = &(*sp)->next) {
+    if ((*sp)->bytes >= bytes && (!region || ((*sp)->free == region->free && (*sp)->ctx == region->ctx))) {
+      s = *sp;
+      *sp = s->next;
+      _spare_count--;
+      break;
+    }
+  }
+  // Spare slabs are already counted in _grown_bytes, so only a new block is checked against the limit
+  if (s) {
+    bytes = s->bytes;
+  } else {
+    if (_grow_limit && _grown_bytes + bytes > _grow_limit) return nullptr;
+    // Slabs come from the segment's region when regions are configured, otherwise from the upstream
+    // allocator or the system heap
+    mempool_upstream src = _upstream;
+    if (region) {
+      src = *region;
+    } else if (!src.alloc || !src.free) {
+      src = {mempool_malloc, mempool_free, nullptr};
+    }
+    uint8_t* block = static_cast<uint8_t*>(src.alloc(bytes, src.ctx));
+    if (!block) return nullptr;
+    s = reinterpret_cast<mempool_slab*>(block);
+    s->bytes = bytes;
+    s->free = src.free;
+    s->ctx = src.ctx;
+    _grown_bytes += bytes;
+  }
+
+  uint8_t* block = reinterpret_cast<uint8_t*>(s);
+  s->next = nullptr;
+  s->mask = reinterpret_cast<mempool_word*>(block + sizeof(mempool_slab));
+  s->data = _align_ptr(reinterpret_cast<uint8_t*>(s->mask + words));
+  // A slab missing from the registry would be invisible to mempool_release_any, so growth fails instead
+  if (!mempool_register(this, s->data, (uint32_t)count * _segment_sizes[sg])) {
+    _grown_bytes -= s->bytes;
+    s->free(s, s->ctx);
+    return nullptr;
+  }
+  s->count = count;
+  s->refs = nullptr;
+  if (_refs_buffer) {
+    s->refs = s->data + (uint32_t)count * _segment_sizes[sg];
+    memset(s->refs, 0, count);
+  }
+  _init_masks(s->mask, count);
+  _init_free_list(sg, s->data, count, s->free_head);
+  s->cursor = 0;
+
+  // Append so older slabs, which are more likely to hold free cells, are searched first
+  mempool_slab** tail = &_slabs[sg];
+  while (*tail) tail = &(*tail)->next;
+  *tail = s;
+  _slab_count[sg]++;
+  return s;
+}
+
+void mempool::set_growth_limit(uint32_t max_bytes) { _grow_limit = max_bytes; }
+
+uint16_t mempool::_free_cells(const mempool_word* pp, uint16_t count) {
+  uint16_t words = mempool_bits::words(count);
+  uint32_t used = mempool_bits::count_set(pp + mempool_bits::headers(count), words);
+  // Padding bits of the last mask word are always set
+  return count - (used - ((uint32_t)words * mempool_bits::bits - count));
+}
+
+void mempool::_drop_slab(uint8_t sg, mempool_slab** link, bool keep) {
+  mempool_slab* s = *link;
+  *link = s->next;
+  _slab_count[sg]--;
+  mempool_unregister(s->data);
+  if (keep && _spare_count < _spare_limit) {
+    s->next = _spare;
+    _spare = s;
+    _spare_count++;
+    return;
+  }
+  _grown_bytes -= s->bytes;
+  s->free(s, s->ctx);
+}
+
+uint32_t mempool::trim() {
+  if (!_initialized) return 0;
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return 0;
+  uint32_t before = _grown_bytes;
+  for (uint8_t sg = 0; sg < _segment_count; sg++) {
+    mempool_slab** link = &_slabs[sg];
+    while (*link) {
+      if (_free_cells((*link)->mask, (*link)->count) == (*link)->count) {
+        _drop_slab(sg, link, false);
+      } else {
+        link = &(*link)->next;
+      }
+    }
+  }
+  while (_spare) {
+    mempool_slab* s = _spare;
+    _spare = s->next;
+    _grown_bytes -= s->bytes;
+    s->free(s, s->ctx);
+  }
+  _spare_count = 0;
+  uint32_t released = before - _grown_bytes;
+  xSemaphoreGive(_mutex);
+  return released;
+}
+
+void mempool::set_auto_trim(uint16_t low_water, uint8_t spare_slabs) {
+  _trim_low_water = low_water;
+  _spare_limit = spare_slabs;
 }
 
 void mempool::print_buffer(uint8_t f) {
   if (!Serial) return;
-  for (uint32_t i = 0; i < _buffer_size; i++) {
-    Serial.print(_buffer[i], f);
-    Serial.print(' ');
+  for (uint8_t r = 0; r < _region_count; r++) {
+    for (uint32_t i = 0; i < _region_size[r]; i++) {
+      Serial.print(_region_buffer[r][i], f);
+      Serial.print(' ');
+    }
+    Serial.println();
   }
-  Serial.println();
 }
 
 void mempool::print_pool(uint8_t f) {
@@ -218,114 +743,729 @@ void mempool::print_stats() {
   Serial.println(_total_allocs);
   Serial.print("Failed allocs: ");
   Serial.println(_failed_allocs);
+  Serial.print("Upstream allocs: ");
+  Serial.println(_upstream_allocs);
+  if (_buddy_buffer) {
+    Serial.print("Buddy allocs: ");
+    Serial.print(_buddy_allocs);
+    Serial.print(", free bytes = ");
+    Serial.print(_buddy.free_bytes());
+    Serial.print(", largest free = ");
+    Serial.println(_buddy.largest_free());
+  }
+  if (_tlsf_buffer) {
+    Serial.print("TLSF allocs: ");
+    Serial.print(_tlsf_allocs);
+    Serial.print(", free bytes = ");
+    Serial.println(_tlsf.free_bytes());
+  }
   for (uint8_t i = 0; i < _segment_count; i++) {
     Serial.print("Segment ");
     Serial.print(i);
     Serial.print(": max cells used = ");
     Serial.print(_max_cells_used[i]);
+    Serial.print(", free cells = ");
+    uint32_t free_cells = _free_cells(_pool_ptr[i], _cell_count[i]);
+    for (mempool_slab* s = _slabs[i]; s; s = s->next) free_cells += _free_cells(s->mask, s->count);
+    Serial.print(free_cells);
+    Serial.print(", slabs = ");
+    Serial.print(_slab_count[i]);
     Serial.print(", allocs = ");
-    Serial.println(_allocs_per_segment[i]);
+    Serial.print(_allocs_per_segment[i]);
+    Serial.print(", spills = ");
+    Serial.println(_spills_per_segment[i]);
   }
 #else
   Serial.println("Debug stats not available. Enable MEMPOOL_STATISTIC to see statistics.");
 #endif
 }
 
+void* mempool_malloc(size_t size, void* ctx) {
+  (void)ctx;
+  return malloc(size);
+}
+
+void mempool_free(void* ptr, void* ctx) {
+  (void)ctx;
+  free(ptr);
+}
+
+#ifdef ESP_PLATFORM
+void* mempool_heap_caps_malloc(size_t size, void* ctx) {
+  return heap_caps_malloc(size, static_cast<uint32_t>(reinterpret_cast<uintptr_t>(ctx)));
+}
+#endif
+
+#if !defined(ESP_PLATFORM) && defined(__has_include)
+#if __has_include(<sys/mman.h>)
+void* mempool_mmap_alloc(size_t size, void* ctx) {
+  (void)ctx;
+  // The mapping length is kept in front of the block for munmap
+  size_t length = size + 2 * sizeof(size_t);
+  void* m = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (m == MAP_FAILED) return nullptr;
+  *static_cast<size_t*>(m) = length;
+  return static_cast<uint8_t*>(m) + 2 * sizeof(size_t);
+}
+
+void mempool_mmap_free(void* ptr, void* ctx) {
+  (void)ctx;
+  uint8_t* m = static_cast<uint8_t*>(ptr) - 2 * sizeof(size_t);
+  munmap(m, *reinterpret_cast<size_t*>(m));
+}
+#endif
+#endif
+
 uint8_t* mempool::alloc(uint16_t size) {
-  if (size > _max_segment_size) {
+  uint8_t sg;
+  uint8_t* p = _alloc(size, sg);
+  if (!p) p = _alloc_variable(size);
+  if (!p) p = _alloc_upstream(size);
+  return p;
+}
+
+uint8_t* mempool::alloc_zeroed(uint16_t size) {
+  uint8_t sg;
+  uint8_t* p = _alloc(size, sg);
+  if (p) {
+    _zero_cell(p, _segment_sizes[sg]);
+  } else {
+    p = _alloc_variable(size);
+    if (!p) p = _alloc_upstream(size);
+    if (p) memset(p, 0, size);
+  }
+  return p;
+}
+
+uint8_t* mempool::alloc_span(uint16_t size, uint16_t cell_size) {
+  if (!_initialized || size == 0) return nullptr;
+  if (cell_size == 0 && size <= _max_segment_size) return alloc(size);
+
+  // Spans come from the largest class, or from the class with the given cell size
+  uint8_t sg = _segment_count - 1;
+  if (cell_size) {
+    if (cell_size > _max_segment_size) return nullptr;
+    sg = _segment_lookup[((cell_size + SEGMENT_STEP - 1) >> SEGMENT_LOG2) - 1];
+    if (_segment_sizes[sg] != cell_size) return nullptr;
+  }
+  uint16_t k = (size + _segment_sizes[sg] - 1) / _segment_sizes[sg];
+  if (k > 1 && _segment_engine[sg] == MEMPOOL_ENGINE_FREELIST) {
+    // Free-list segments keep no masks to search for runs of cells
+    uint8_t* p = _alloc_variable(size);
+    return p ? p : _alloc_upstream(size);
+  }
+
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return nullptr;
+  uint8_t* p = nullptr;
+  if (k == 1) {
+    p = _take_from_segment(sg);
+  } else {
+    int32_t cell = _take_span(_pool_ptr[sg], _cell_count[sg], k);
+    if (cell >= 0) p = _segment_ptr[sg] + cell * _segment_sizes[sg];
+    for (mempool_slab* s = _slabs[sg]; s && !p; s = s->next) {
+      cell = _take_span(s->mask, s->count, k);
+      if (cell >= 0) p = s->data + cell * _segment_sizes[sg];
+    }
+    if (!p && k <= _grow_count[sg]) {
+      mempool_slab* s = _grow(sg);
+      if (s) p = s->data + _take_span(s->mask, s->count, k) * _segment_sizes[sg];
+    }
+  }
 #ifdef MEMPOOL_STATISTIC
-    _failed_allocs++;
-#endif
-    return nullptr;
+  if (p) {
+    _total_allocs++;
+    _allocs_per_segment[sg]++;
+    _cells_used[sg] += k;
+    if (_cells_used[sg] > _max_cells_used[sg]) _max_cells_used[sg] = _cells_used[sg];
   }
-  uint8_t sg = _segment_lookup[((size + SEGMENT_STEP - 1) >> SEGMENT_LOG2) - 1];
-  if (sg >= _segment_count) {
+#endif
+  xSemaphoreGive(_mutex);
+  if (!p) p = _alloc_variable(size);
+  if (!p) p = _alloc_upstream(size);
+  return p;
+}
+
+uint8_t* mempool::alloc_aligned(uint16_t size, uint16_t align) {
+  if (align <= SEGMENT_STEP) return alloc(size);
+  uint8_t* p = _alloc_pooled(size, align);
+  if (p) return p;
+  p = _alloc_upstream(size);
+  if (p && (reinterpret_cast<uintptr_t>(p) & (align - 1))) {
+    _upstream.free(p, _upstream.ctx);
 #ifdef MEMPOOL_STATISTIC
+    _upstream_allocs--;
     _failed_allocs++;
 #endif
     return nullptr;
   }
+  return p;
+}
 
-  uint8_t* p = _segment_ptr[sg];
-
-  if (*_pool_ptr[sg] == 0xFFFFFFFF) {
-    if (sg < _segment_count - 1) {
-      return alloc(_segment_sizes[sg + 1]);
-    } else {
+uint8_t* mempool::alloc_pooled(uint16_t size, uint16_t align) {
+  uint8_t* p = _alloc_pooled(size, align);
 #ifdef MEMPOOL_STATISTIC
-      _failed_allocs++;
+  // Pool memory is the last resort here, as upstream is for alloc
+  if (!p) _failed_allocs++;
 #endif
-      return nullptr;
+  return p;
+}
+
+uint8_t* mempool::_alloc_pooled(uint16_t size, uint16_t align) {
+  uint8_t sg;
+  uint8_t* p = _alloc(size, sg, align);
+  // Buddy and TLSF blocks start at MEMPOOL_ALIGN boundaries
+  if (!p && align <= MEMPOOL_ALIGN) p = _alloc_variable(size);
+  return p;
+}
+
+bool mempool::owns(const void* ptr) {
+  const uint8_t* p = static_cast<const uint8_t*>(ptr);
+  if (!_initialized || !p) return false;
+  if (_find_segment(p) >= 0 || _buddy.owns(p) || _tlsf.owns(p)) return true;
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return false;
+  bool found = false;
+  for (uint8_t sg = 0; sg < _segment_count && !found; sg++) {
+    for (mempool_slab* s = _slabs[sg]; s && !found; s = s->next) {
+      found = p >= s->data && p < s->data + s->count * _segment_sizes[sg];
     }
   }
+  xSemaphoreGive(_mutex);
+  return found;
+}
+
+int16_t mempool::segment_for(uint16_t size) {
+  if (!_initialized || size == 0 || size > _max_segment_size) return -1;
+  return _segment_lookup[((size + SEGMENT_STEP - 1) >> SEGMENT_LOG2) - 1];
+}
+
+int16_t mempool::segment_for(uint16_t size, uint16_t align) {
+  int16_t sg = segment_for(size);
+  if (sg < 0) return -1;
+  for (; sg < _segment_count; sg++) {
+    if (cell_align(sg) >= align) return sg;
+  }
+  return -1;
+}
+
+uint8_t mempool::cell_align(uint8_t sg) {
+  if (!_initialized || sg >= _segment_count) return 0;
+  uint16_t a = _segment_sizes[sg] & -_segment_sizes[sg];
+  return a < MEMPOOL_ALIGN ? a : MEMPOOL_ALIGN;
+}
+
+uint8_t* mempool::alloc_from(uint8_t sg) {
+  if (!_initialized || sg >= _segment_count) return nullptr;
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return nullptr;
+  uint8_t* p = _take_from_segment(sg);
+#ifdef MEMPOOL_STATISTIC
+  if (p) {
+    _total_allocs++;
+    _allocs_per_segment[sg]++;
+    if (++_cells_used[sg] > _max_cells_used[sg]) _max_cells_used[sg] = _cells_used[sg];
+  }
+#endif
+  xSemaphoreGive(_mutex);
+  return p;
+}
+
+uint8_t* mempool::_alloc_variable(uint16_t size) {
+  if (size == 0 || (!_tlsf_buffer && (!_buddy_buffer || size <= _max_segment_size))) return nullptr;
   if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return nullptr;
-  uint8_t pool_index = __builtin_ctz(~_pool_ptr[sg][0]);
-  if (pool_index >= (_cell_count[sg] + 31) / 32) {
-    xSemaphoreGive(_mutex);
+  uint8_t* p = nullptr;
+  if (_buddy_buffer && size > _max_segment_size) {
+    p = _buddy.alloc(size);
 #ifdef MEMPOOL_STATISTIC
-    _failed_allocs++;
+    if (p) _buddy_allocs++;
 #endif
-    return nullptr;
   }
-  uint32_t* cell_mask = &_pool_ptr[sg][pool_index + 1];
-
-  uint8_t cell_index = __builtin_ctz(~*cell_mask);
-  bitSet(*cell_mask, cell_index);
-  if (*cell_mask == 0xFFFFFFFF) {
-    bitSet(*_pool_ptr[sg], pool_index);
+  if (!p && _tlsf_buffer) {
+    p = _tlsf.alloc(size);
+#ifdef MEMPOOL_STATISTIC
+    if (p) _tlsf_allocs++;
+#endif
   }
   xSemaphoreGive(_mutex);
+  return p;
+}
+
+bool mempool::set_buddy(uint32_t size, uint16_t min_block, uint8_t region) {
+  if (!_initialized || _buddy_buffer || region >= _region_count || size == 0) return false;
+  uint8_t* buffer = static_cast<uint8_t*>(_regions[region].provider.alloc(size, _regions[region].provider.ctx));
+  if (!buffer) return false;
+  if (!_buddy.begin(buffer, size, min_block)) {
+    _regions[region].provider.free(buffer, _regions[region].provider.ctx);
+    return false;
+  }
+  if (!mempool_register(this, buffer, size)) {
+    _buddy.clean();
+    _regions[region].provider.free(buffer, _regions[region].provider.ctx);
+    return false;
+  }
+  _buddy_buffer = buffer;
+  _buddy_region = region;
+  return true;
+}
+
+bool mempool::set_tlsf(uint32_t size, uint8_t region) {
+  if (!_initialized || _tlsf_buffer || region >= _region_count || size == 0) return false;
+  uint8_t* buffer = static_cast<uint8_t*>(_regions[region].provider.alloc(size, _regions[region].provider.ctx));
+  if (!buffer) return false;
+  if (!_tlsf.begin(buffer, size)) {
+    _regions[region].provider.free(buffer, _regions[region].provider.ctx);
+    return false;
+  }
+  if (!mempool_register(this, buffer, size)) {
+    _tlsf.clean();
+    _regions[region].provider.free(buffer, _regions[region].provider.ctx);
+    return false;
+  }
+  _tlsf_buffer = buffer;
+  _tlsf_region = region;
+  return true;
+}
+
+uint8_t* mempool::_alloc_upstream(uint16_t size) {
+  uint8_t* p = nullptr;
+  if (_upstream.alloc && size) p = static_cast<uint8_t*>(_upstream.alloc(size, _upstream.ctx));
+#ifdef MEMPOOL_STATISTIC
+  // Upstream is the last fallback, so only its misses fail the request
+  if (p) {
+    _upstream_allocs++;
+  } else {
+    _failed_allocs++;
+  }
+#endif
+  return p;
+}
+
+void mempool::set_upstream(const mempool_upstream* upstream) {
+  if (upstream) {
+    _upstream = *upstream;
+  } else {
+    _upstream = {nullptr, nullptr, nullptr};
+  }
+}
+
+uint8_t* mempool::_alloc(uint16_t size, uint8_t& sg, uint16_t align) {
+  if (size == 0 || size > _max_segment_size) return nullptr;
+  uint8_t first = _segment_lookup[((size + SEGMENT_STEP - 1) >> SEGMENT_LOG2) - 1];
+  if (first >= _segment_count) return nullptr;
+  // The smallest class with aligned cells stands in for the size class
+  while (align > SEGMENT_STEP && first < _segment_count && cell_align(first) < align) first++;
+  if (first >= _segment_count) return nullptr;
+  uint8_t last = _spill_last_segment(first, size);
+
+  // Walk the allowed classes under the mutex so the full check and the bit update are atomic
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return nullptr;
+  // Spill into segments of the same memory tier first, then into the other tiers
+  uint8_t tier = _regions[_segment_region[first]].tier;
+  for (uint8_t pass = 0; pass < 2; pass++) {
+    for (sg = first; sg <= last; ++sg) {
+      if ((_regions[_segment_region[sg]].tier == tier) != (pass == 0)) continue;
+      if (align > SEGMENT_STEP && cell_align(sg) < align) continue;
+      uint8_t* p = _take_from_segment(sg);
+      if (!p) continue;
 #ifdef MEMPOOL_STATISTIC
-  _total_allocs++;
-  _allocs_per_segment[sg]++;
-  uint16_t used_cells = pool_index * 32 + cell_index;
-  if (used_cells > _max_cells_used[sg]) _max_cells_used[sg] = used_cells;
+      _total_allocs++;
+      _allocs_per_segment[sg]++;
+      if (sg != first) _spills_per_segment[first]++;
+      if (++_cells_used[sg] > _max_cells_used[sg]) _max_cells_used[sg] = _cells_used[sg];
 #endif
-  return _segment_ptr[sg] + (pool_index * 32 + cell_index) * _segment_sizes[sg];
+      xSemaphoreGive(_mutex);
+      return p;
+    }
+    if (_region_count == 1) break;
+  }
+  xSemaphoreGive(_mutex);
+  return nullptr;
 }
 
-void mempool::release(uint8_t* ptr) {
-  if (!_initialized || !ptr || ptr < _buffer || ptr >= _buffer + _buffer_size) {
+uint8_t mempool::_spill_last_segment(uint8_t first, uint16_t size) {
+  uint8_t last = _segment_count - 1;
+  switch (_spill_policy) {
+    case MEMPOOL_SPILL_NONE:
+      return first;
+    case MEMPOOL_SPILL_CLASSES:
+      return (last - first > _spill_limit) ? first + _spill_limit : last;
+    case MEMPOOL_SPILL_WASTE: {
+      uint8_t i = first;
+      while (i < last && _segment_sizes[i + 1] - size <= _spill_limit) i++;
+      return i;
+    }
+    default:
+      return last;
+  }
+}
+
+void mempool::set_spill_policy(spill_policy policy, uint16_t limit) {
+  _spill_policy = policy;
+  _spill_limit = limit;
+}
+
+void mempool::_zero_cell(uint8_t* p, uint16_t size) {
+#if UINTPTR_MAX > 0xFFFFFFFF
+  // 64-bit targets: clear with 64-bit stores when the cell allows it
+  if (!((size | reinterpret_cast<uintptr_t>(p)) & 7)) {
+    uint64_t* d = reinterpret_cast<uint64_t*>(p);
+    switch (size >> 3) {
+      case 8: d[7] = 0;  // fall through
+      case 7: d[6] = 0;  // fall through
+      case 6: d[5] = 0;  // fall through
+      case 5: d[4] = 0;  // fall through
+      case 4: d[3] = 0;  // fall through
+      case 3: d[2] = 0;  // fall through
+      case 2: d[1] = 0;  // fall through
+      case 1: d[0] = 0;  // fall through
+      default: break;
+    }
     return;
   }
+#endif
+  // Cell sizes are multiples of SEGMENT_STEP and at most 64 bytes, so every class is one unrolled case
+  uint32_t* w = reinterpret_cast<uint32_t*>(p);
+  switch (size >> SEGMENT_LOG2) {
+    case 16: w[15] = 0;  // fall through
+    case 15: w[14] = 0;  // fall through
+    case 14: w[13] = 0;  // fall through
+    case 13: w[12] = 0;  // fall through
+    case 12: w[11] = 0;  // fall through
+    case 11: w[10] = 0;  // fall through
+    case 10: w[9] = 0;   // fall through
+    case 9: w[8] = 0;    // fall through
+    case 8: w[7] = 0;    // fall through
+    case 7: w[6] = 0;    // fall through
+    case 6: w[5] = 0;    // fall through
+    case 5: w[4] = 0;    // fall through
+    case 4: w[3] = 0;    // fall through
+    case 3: w[2] = 0;    // fall through
+    case 2: w[1] = 0;    // fall through
+    case 1: w[0] = 0;    // fall through
+    default: break;
+  }
+}
 
-  // Binary search for segment (O(log n), efficient for large segment counts)
-  int8_t sg = -1;
-  uint8_t l = 0, r = _segment_count - 1;
-  while (l <= r) {
-    uint8_t m = (l + r) >> 1;
-    if (ptr < _segment_ptr[m]) {
-      r = m - 1;
-    } else {
-      sg = m;
-      l = m + 1;
+void mempool::release(uint8_t* ptr) { _release(ptr, 0); }
+
+void mempool::release(uint8_t* ptr, uint16_t size) {
+  if (!_initialized || !ptr) return;
+  // Not pool memory: hand it back to the upstream allocator that served it
+  if (!release_pooled(ptr, size) && _upstream.free) _upstream.free(ptr, _upstream.ctx);
+}
+
+bool mempool::release_pooled(uint8_t* ptr, uint16_t size, uint16_t align) {
+  if (!_initialized || !ptr) return false;
+  // Size and alignment name the segment the block most likely came from, the address search only runs for the
+  // others
+  int16_t sg = align > SEGMENT_STEP ? segment_for(size, align) : segment_for(size);
+  if (sg < 0 || ptr < _segment_ptr[sg] || ptr >= _segment_ptr[sg] + _segment_sizes[sg] * _cell_count[sg]) {
+    sg = _find_segment(ptr);
+    if (sg == -1) return _release_outside(ptr, 0);
+  }
+  uint16_t cellIndex = _cell_index(sg, ptr - _segment_ptr[sg]);
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return true;
+  uint16_t freed = _put_cells(sg, _segment_ptr[sg], _pool_ptr[sg], _cell_count[sg], cellIndex, 0, _free_head[sg],
+                              _refs_ptr ? _refs_ptr[sg] : nullptr);
+#ifdef MEMPOOL_STATISTIC
+  _cells_used[sg] -= freed;
+#else
+  (void)freed;
+#endif
+  xSemaphoreGive(_mutex);
+  return true;
+}
+
+void mempool::release_batch(void* const* ptrs, uint16_t count) {
+  if (!_initialized || !ptrs || !count) return;
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return;
+  uint16_t outside = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    uint8_t* ptr = static_cast<uint8_t*>(ptrs[i]);
+    if (!ptr) continue;
+    int16_t sg = _find_segment(ptr);
+    if (sg == -1) {
+      outside++;
+      continue;
     }
+    uint16_t cellIndex = _cell_index(sg, ptr - _segment_ptr[sg]);
+    uint16_t freed = _put_cells(sg, _segment_ptr[sg], _pool_ptr[sg], _cell_count[sg], cellIndex, 0, _free_head[sg],
+                                _refs_ptr ? _refs_ptr[sg] : nullptr);
+#ifdef MEMPOOL_STATISTIC
+    _cells_used[sg] -= freed;
+#else
+    (void)freed;
+#endif
+  }
+  xSemaphoreGive(_mutex);
+  // Slab cells and foreign blocks take the mutex themselves
+  for (uint16_t i = 0; outside && i < count; i++) {
+    uint8_t* ptr = static_cast<uint8_t*>(ptrs[i]);
+    if (!ptr || _find_segment(ptr) != -1) continue;
+    if (!_release_outside(ptr, 0) && _upstream.free) _upstream.free(ptr, _upstream.ctx);
+    outside--;
+  }
+}
+
+uint8_t* mempool::alloc_span_aligned(uint16_t size, uint16_t align) {
+  if (!_initialized || size == 0) return nullptr;
+  if (align <= SEGMENT_STEP) return alloc_span(size);
+  if (size <= _max_segment_size || cell_align(_segment_count - 1) < align) return alloc_aligned(size, align);
+  uint8_t* p = alloc_span(size);
+  // Only an upstream fallback can still miss the alignment
+  if (p && (reinterpret_cast<uintptr_t>(p) & (align - 1))) {
+    release_span(p, size);
+    p = nullptr;
+  }
+  return p;
+}
+
+void mempool::release_span(uint8_t* ptr, uint16_t size) { _release(ptr, size); }
+
+uint16_t mempool::_put_cells(uint8_t sg, uint8_t* data, mempool_word* pp, uint16_t count, uint16_t cell, uint16_t size,
+                             uint16_t& head, uint8_t* refs) {
+  // A shared cell only loses a reference
+  if (refs && size <= _segment_sizes[sg] && refs[cell]) {
+    refs[cell]--;
+    return 0;
+  }
+  uint16_t k = size > _segment_sizes[sg] ? (size + _segment_sizes[sg] - 1) / _segment_sizes[sg] : 1;
+  if ((uint32_t)cell + k > count) k = count - cell;
+  uint16_t freed = 0;
+  for (uint16_t i = 0; i < k; i++) {
+    if (_put(sg, data, pp, count, cell + i, head)) freed++;
+  }
+  return freed;
+}
+
+void mempool::_release(uint8_t* ptr, uint16_t size) {
+  if (!_initialized || !ptr) {
+    return;
   }
+  int16_t sg = _find_segment(ptr);
   if (sg == -1) {
+    // Not pool memory: hand it back to the upstream allocator that served it
+    if (!_release_outside(ptr, size) && _upstream.free) _upstream.free(ptr, _upstream.ctx);
     return;
   }
 
-  uint8_t* base = _segment_ptr[sg];
-  uint16_t offset = ptr - base;
-  uint8_t cellIndex;
-  if (_segment_sizes[sg] & (_segment_sizes[sg] - 1)) {
-    // Non-power-of-2 sizes use magic number for fast division
-    cellIndex = ((offset >> 2) * _magic_number[sg]) >> 16;
-  } else {
-    // Power-of-2 sizes use bit shift for fast division
-    cellIndex = offset >> _segment_shift[sg];
+  uint16_t cellIndex = _cell_index(sg, ptr - _segment_ptr[sg]);
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return;
+  uint16_t freed = _put_cells(sg, _segment_ptr[sg], _pool_ptr[sg], _cell_count[sg], cellIndex, size, _free_head[sg],
+                              _refs_ptr ? _refs_ptr[sg] : nullptr);
+#ifdef MEMPOOL_STATISTIC
+  _cells_used[sg] -= freed;
+#else
+  (void)freed;
+#endif
+  xSemaphoreGive(_mutex);
+}
+
+bool mempool::_release_outside(uint8_t* ptr, uint16_t size) {
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return true;
+  if (_buddy.release(ptr) || _tlsf.release(ptr)) {
+    xSemaphoreGive(_mutex);
+    return true;
+  }
+  for (uint8_t sg = 0; sg < _segment_count; sg++) {
+    for (mempool_slab** link = &_slabs[sg]; *link; link = &(*link)->next) {
+      mempool_slab* s = *link;
+      if (ptr < s->data || ptr >= s->data + s->count * _segment_sizes[sg]) continue;
+      uint16_t cellIndex = _cell_index(sg, ptr - s->data);
+      uint16_t freed = _put_cells(sg, s->data, s->mask, s->count, cellIndex, size, s->free_head, s->refs);
+      if (!freed) {
+        xSemaphoreGive(_mutex);
+        return true;
+      }
+#ifdef MEMPOOL_STATISTIC
+      _cells_used[sg] -= freed;
+#endif
+      if (_trim_low_water != MEMPOOL_TRIM_OFF && _free_cells(s->mask, s->count) == s->count) {
+        _auto_trim(sg, link);
+      }
+      xSemaphoreGive(_mutex);
+      return true;
+    }
+  }
+  xSemaphoreGive(_mutex);
+  return false;
+}
+
+bool mempool::mark(mempool_mark& m) {
+  if (!_initialized) {
+    m.clear();
+    return false;
+  }
+  // Marking again, as mempool_scope::rollback does, overwrites the snapshot in place
+  if (!m._words || m._size != _pool_size) {
+    m.clear();
+    m._words = new mempool_word[_pool_size];
+    if (!m._words) return false;
+  }
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) {
+    m.clear();
+    return false;
   }
-  uint8_t poolIndex = cellIndex >> 5;
-  uint8_t bitIndex = cellIndex & 31;
+  memcpy(m._words, _pool_buffer, _pool_size * sizeof(mempool_word));
+  xSemaphoreGive(_mutex);
+  m._pool = this;
+  m._size = _pool_size;
+  return true;
+}
 
-  uint32_t* pp = _pool_ptr[sg];
+void mempool::rollback(const mempool_mark& m) {
+  if (!_initialized || m._pool != this || m._size != _pool_size) return;
   if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return;
-  bitClear(*pp, poolIndex);
-  pp += poolIndex + 1;
-  bitClear(*pp, bitIndex);
+  for (uint8_t sg = 0; sg < _segment_count; sg++) {
+    mempool_word* pp = _pool_ptr[sg];
+    const mempool_word* snap = m._words + (pp - _pool_buffer);
+    uint16_t headers = mempool_bits::headers(_cell_count[sg]);
+    uint16_t words = mempool_bits::words(_cell_count[sg]);
+    for (uint16_t w = 0; w < words; w++) {
+      // Cells used now that were free at the mark
+      mempool_word taken = pp[headers + w] & ~snap[headers + w];
+      if (taken) _put_word(sg, w, taken);
+    }
+  }
   xSemaphoreGive(_mutex);
 }
 
+void mempool::_put_word(uint8_t sg, uint16_t word, mempool_word bits) {
+  mempool_word* pp = _pool_ptr[sg];
+  if (_segment_engine[sg] == MEMPOOL_ENGINE_FREELIST) {
+    // The free list needs every cell pushed
+    for (mempool_word b = bits; b; b &= b - 1) {
+      uint16_t cell = (word << mempool_bits::shift) + mempool_bits::ctz(b);
+      _put(sg, _segment_ptr[sg], pp, _cell_count[sg], cell, _free_head[sg]);
+    }
+  } else {
+    pp[mempool_bits::headers(_cell_count[sg]) + word] &= ~bits;
+    pp[word >> mempool_bits::shift] &= ~(static_cast<mempool_word>(1) << (word & (mempool_bits::bits - 1)));
+  }
+  if (_refs_ptr) {
+    for (mempool_word b = bits; b; b &= b - 1) _refs_ptr[sg][(word << mempool_bits::shift) + mempool_bits::ctz(b)] = 0;
+  }
+#ifdef MEMPOOL_STATISTIC
+  _cells_used[sg] -= mempool_bits::popcount(bits);
+#endif
+}
+
+bool mempool::enable_refcounts() {
+  if (!_initialized) return false;
+  // Held throughout, so no slab is grown or given up between counting the cells and handing out counters
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return false;
+  if (_refs_buffer) {
+    xSemaphoreGive(_mutex);
+    return true;
+  }
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < _segment_count; i++) {
+    total += _cell_count[i];
+    for (mempool_slab* s = _slabs[i]; s; s = s->next) total += s->count;
+  }
+  uint8_t** ptrs = new (std::nothrow) uint8_t*[_segment_count];
+  uint8_t* buffer = ptrs ? new (std::nothrow) uint8_t[total ? total : 1]{} : nullptr;
+  if (!buffer) {
+    delete[] ptrs;
+    xSemaphoreGive(_mutex);
+    return false;
+  }
+  uint8_t* p = buffer;
+  for (uint8_t i = 0; i < _segment_count; i++) {
+    ptrs[i] = p;
+    p += _cell_count[i];
+  }
+  // Slabs grown before now have no room for counters in their block, theirs follow the segments' counters
+  for (uint8_t i = 0; i < _segment_count; i++) {
+    for (mempool_slab* s = _slabs[i]; s; s = s->next) {
+      s->refs = p;
+      p += s->count;
+    }
+  }
+  _refs_ptr = ptrs;
+  _refs_buffer = buffer;
+  xSemaphoreGive(_mutex);
+  return true;
+}
+
+uint8_t* mempool::_ref_counter(const uint8_t* ptr) {
+  if (!_refs_buffer || !ptr) return nullptr;
+  int16_t sg = _find_segment(ptr);
+  const mempool_word* pp = nullptr;
+  uint16_t count = 0;
+  uint16_t cell = 0;
+  uint8_t* refs = nullptr;
+  if (sg >= 0) {
+    pp = _pool_ptr[sg];
+    count = _cell_count[sg];
+    cell = _cell_index(sg, ptr - _segment_ptr[sg]);
+    refs = _refs_ptr[sg];
+  } else {
+    for (uint8_t i = 0; i < _segment_count && !pp; i++) {
+      for (mempool_slab* s = _slabs[i]; s; s = s->next) {
+        if (ptr < s->data || ptr >= s->data + s->count * _segment_sizes[i]) continue;
+        pp = s->mask;
+        count = s->count;
+        cell = _cell_index(i, ptr - s->data);
+        refs = s->refs;
+        break;
+      }
+    }
+  }
+  if (!refs) return nullptr;
+  uint16_t word = mempool_bits::headers(count) + (cell >> mempool_bits::shift);
+  if (!((pp[word] >> (cell & (mempool_bits::bits - 1))) & 1)) return nullptr;  // Free cell
+  return &refs[cell];
+}
+
+bool mempool::retain(void* ptr) {
+  if (!_initialized || xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return false;
+  uint8_t* r = _ref_counter(static_cast<uint8_t*>(ptr));
+  bool ok = r && *r < 0xFF;
+  if (ok) (*r)++;
+  xSemaphoreGive(_mutex);
+  return ok;
+}
+
+uint16_t mempool::ref_count(const void* ptr) {
+  if (!_initialized || xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return 0;
+  uint8_t* r = _ref_counter(static_cast<const uint8_t*>(ptr));
+  uint16_t n = r ? *r + 1 : 0;
+  xSemaphoreGive(_mutex);
+  return n;
+}
+
+mempool_mark::~mempool_mark() {
+  clear();
+}
+
+void mempool_mark::clear() {
+  if (_words) delete[] _words;
+  _words = nullptr;
+  _pool = nullptr;
+  _size = 0;
+}
+
+mempool_scope::mempool_scope(mempool& pool) : _pool(pool) {
+  _pool.mark(_mark);
+}
+
+mempool_scope::~mempool_scope() {
+  if (_mark.valid()) _pool.rollback(_mark);
+}
+
+void mempool_scope::rollback() {
+  if (_mark.valid()) _pool.rollback(_mark);
+  _pool.mark(_mark);
+}
+
+void mempool::_auto_trim(uint8_t sg, mempool_slab** link) {
+  // Give the empty slab up only while the segment keeps low_water free cells without it
+  uint32_t spare = _free_cells(_pool_ptr[sg], _cell_count[sg]);
+  for (mempool_slab* s = _slabs[sg]; s && spare < _trim_low_water; s = s->next) {
+    if (s != *link) spare += _free_cells(s->mask, s->count);
+  }
+  if (spare >= _trim_low_water) _drop_slab(sg, link, true);
+}
+
 uint16_t mempool::max_segment_size() { return _max_segment_size; }
 
 mempool mem;
\ No newline at end of file
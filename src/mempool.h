@@ -1,8 +1,31 @@
 #pragma once
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include <new>
+#include <utility>
+
+#include "mempool_bitmap.h"
+#include "mempool_buddy.h"
+#include "mempool_tlsf.h"
+
+#define MEMPOOL_NO_CELL 0xFFFF  ///< Free list terminator.
+
+#ifndef MEMPOOL_ALIGN
+#define MEMPOOL_ALIGN alignof(max_align_t)  ///< Alignment of segment and slab starts (power of 2).
+#endif
+
+/**
+ * @brief Allocation engine of a segment.
+ */
+enum segment_engine : uint8_t {
+  MEMPOOL_ENGINE_BITMAP = 0,  ///< Two-level bitmap, hands out the lowest free cell (default).
+  MEMPOOL_ENGINE_FREELIST,    ///< Intrusive LIFO free list, reuses the most recently freed cell in O(1).
+  MEMPOOL_ENGINE_NEXTFIT      ///< Two-level bitmap searched from a rotating cursor (next fit).
+};
+
 /**
  * @brief Structure to define a memory segment with count and size.
  */
@@ -11,12 +34,102 @@ struct segment {
    * @brief Constructor for segment.
    * @param c Number of cells in the segment.
    * @param s Size of each cell in the segment (in units of SEGMENT_STEP).
+   * @param gc Number of cells in each extra slab the segment may grow by (0 disables growth).
+   * @param gs Maximum number of extra slabs.
+   * @param r Index of the region providing the segment's memory (see mempool_region).
+   * @param e Allocation engine of the segment.
    */
-  segment(uint16_t c, uint16_t s) : count(c), size(s) {}
-  uint16_t count;  ///< Number of cells in the segment.
-  uint8_t size;    ///< Size of each cell (in units of SEGMENT_STEP).
+  segment(uint16_t c, uint16_t s, uint16_t gc = 0, uint8_t gs = 0, uint8_t r = 0, segment_engine e = MEMPOOL_ENGINE_BITMAP)
+      : count(c), size(s), grow_count(gc), grow_slabs(gs), region(r), engine(e) {}
+  uint16_t count;       ///< Number of cells in the segment.
+  uint8_t size;         ///< Size of each cell (in units of SEGMENT_STEP).
+  uint16_t grow_count;  ///< Cells per extra slab (0 disables growth).
+  uint8_t grow_slabs;   ///< Maximum number of extra slabs.
+  uint8_t region;       ///< Region providing the segment's memory.
+  segment_engine engine;  ///< Allocation engine of the segment.
+};
+
+#define MEMPOOL_TRIM_OFF 0xFFFF  ///< set_auto_trim low-water value disabling automatic trimming.
+
+/**
+ * @brief Extra slab of cells chained to a segment once its cells are exhausted.
+ * @details The header, the pool masks and the cells share one upstream block: [mempool_slab][masks][cells].
+ */
+struct mempool_slab {
+  mempool_slab* next;                  ///< Next slab of the same segment.
+  mempool_word* mask;                  ///< Pool masks (header masks followed by cell masks).
+  uint8_t* data;                       ///< First cell of the slab.
+  uint16_t count;                      ///< Number of cells in the slab.
+  uint16_t free_head;                  ///< First cell of the free list (MEMPOOL_ENGINE_FREELIST only).
+  uint16_t cursor;                     ///< Cell the next search starts at (MEMPOOL_ENGINE_NEXTFIT only).
+  uint32_t bytes;                      ///< Size of the whole block in bytes.
+  uint8_t* refs;                       ///< Extra reference count per cell, nullptr without reference counts.
+  void (*free)(void* ptr, void* ctx);  ///< Hook returning the block to the allocator it came from.
+  void* ctx;                           ///< Context passed to free.
+};
+
+/**
+ * @brief Allocator hooks serving memory from outside the pool.
+ * @details Both hooks receive the user context given in ctx.
+ */
+struct mempool_upstream {
+  void* (*alloc)(size_t size, void* ctx);  ///< Allocates size bytes, returns nullptr on failure.
+  void (*free)(void* ptr, void* ctx);      ///< Frees a block returned by alloc.
+  void* ctx;                               ///< User context passed to both hooks.
+};
+
+/**
+ * @brief Upstream hook allocating from the system heap with malloc.
+ */
+void* mempool_malloc(size_t size, void* ctx);
+
+/**
+ * @brief Upstream hook returning memory to the system heap with free.
+ */
+void mempool_free(void* ptr, void* ctx);
+
+#ifdef ESP_PLATFORM
+/**
+ * @brief Upstream hook allocating with heap_caps_malloc.
+ * @details ctx carries the MALLOC_CAP_* flags, e.g. (void*)MALLOC_CAP_SPIRAM. Release with mempool_free.
+ */
+void* mempool_heap_caps_malloc(size_t size, void* ctx);
+#elif defined(__has_include)
+#if __has_include(<sys/mman.h>)
+/**
+ * @brief Upstream hook mapping anonymous memory with mmap (hosts only).
+ */
+void* mempool_mmap_alloc(size_t size, void* ctx);
+
+/**
+ * @brief Upstream hook unmapping memory returned by mempool_mmap_alloc.
+ */
+void mempool_mmap_free(void* ptr, void* ctx);
+#endif
+#endif
+
+/**
+ * @brief Memory region providing the backing memory of segments.
+ * @details Segments of one region share one block from its provider, and their extra slabs are drawn from it too.
+ *          Hot small classes can then live in fast internal SRAM while large, cold classes live in PSRAM.
+ */
+struct mempool_region {
+  mempool_upstream provider;  ///< Hooks allocating the region's memory.
+  uint8_t tier;               ///< Memory tier (0 is fastest). Spilling tries segments of the same tier first.
+};
+
+/**
+ * @brief Policy applied when the best fitting segment has no free cell.
+ */
+enum spill_policy : uint8_t {
+  MEMPOOL_SPILL_ANY = 0,  ///< Spill into any larger segment (default).
+  MEMPOOL_SPILL_NONE,     ///< Never spill, the allocation fails.
+  MEMPOOL_SPILL_CLASSES,  ///< Spill at most `limit` segment classes up.
+  MEMPOOL_SPILL_WASTE     ///< Spill only into segments wasting at most `limit` bytes.
 };
 
+class mempool_mark;
+
 /**
  * @brief Memory pool class for dynamic memory management on Arduino.
  * @details Manages a pool of fixed-size memory segments for efficient allocation and deallocation.
@@ -44,9 +157,12 @@ class mempool {
    * @brief Initializes the memory pool with given segments.
    * @param segs Array of segments to initialize the pool.
    * @param count Number of segments (must be <= 64).
-   * @return True if initialization is successful, false otherwise.
+   * @param regions Regions providing segment memory, indexed by segment::region (nullptr for one heap block).
+   * @param region_count Number of regions.
+   * @return True if initialization is successful, false otherwise (including when the pool registry cannot
+   *         take the region buffers).
    */
-  bool begin(segment* segs, uint8_t count);
+  bool begin(segment* segs, uint8_t count, const mempool_region* regions = nullptr, uint8_t region_count = 0);
 
   /**
    * @brief Prints the buffer content to Serial.
@@ -83,19 +199,171 @@ class mempool {
    * @brief Template method to allocate memory for an array of type T.
    * @tparam T Type of the elements to allocate.
    * @param count Number of elements to allocate.
-   * @return Pointer to the allocated memory, or nullptr if allocation fails.
+   * @return Pointer to the allocated memory, or nullptr if allocation fails or the size overflows 16 bits.
    * @note The returned pointer must be released using release<T>.
    */
   template <typename T>
   T* alloc(uint8_t count);
 
+  /**
+   * @brief Allocates a memory block with a given alignment.
+   * @param size Size of the memory block to allocate (in bytes).
+   * @param align Required alignment (power of 2).
+   * @return Pointer to the block, or nullptr if no aligned segment cell or upstream block is available.
+   * @details Served like alloc, with segments whose cells are less aligned than align skipped while spilling.
+   *          Buddy and TLSF blocks meet any alignment up to MEMPOOL_ALIGN; an upstream block is accepted only
+   *          if it meets the alignment.
+   */
+  uint8_t* alloc_aligned(uint16_t size, uint16_t align);
+
+  /**
+   * @brief Allocates a cell from a given segment, skipping the size lookup and spilling.
+   * @param sg Segment index, as returned by segment_for.
+   * @return Pointer to the cell, or nullptr if the segment (with its slabs) is full.
+   */
+  uint8_t* alloc_from(uint8_t sg);
+
+  /**
+   * @brief Allocates from the pool's own memory only: segments, buddy and TLSF, never upstream.
+   * @param size Size of the memory block to allocate (in bytes).
+   * @param align Required alignment (power of 2).
+   * @return Pointer to the block, or nullptr if the pool cannot serve it.
+   * @details Blocks returned here are always recognized by owns(). Segments whose cells are less aligned than
+   *          align are skipped while spilling, and buddy and TLSF serve alignments up to MEMPOOL_ALIGN.
+   */
+  uint8_t* alloc_pooled(uint16_t size, uint16_t align = 1);
+
+  /**
+   * @brief Checks whether a pointer lies in memory owned by the pool (segments, slabs, buddy, TLSF).
+   * @param ptr Pointer to check.
+   * @return True if the pool owns ptr, false for upstream blocks and foreign pointers.
+   */
+  bool owns(const void* ptr);
+
+  /**
+   * @brief Finds the best fitting segment for a size.
+   * @param size Size in bytes.
+   * @return Segment index, or -1 if the pool is not initialized or no segment is large enough.
+   */
+  int16_t segment_for(uint16_t size);
+
+  /**
+   * @brief Finds the smallest segment whose cells hold a size at a given alignment.
+   * @param size Size in bytes.
+   * @param align Required alignment (power of 2).
+   * @return Segment index, or -1 if no segment is large enough and aligned enough.
+   */
+  int16_t segment_for(uint16_t size, uint16_t align);
+
+  /**
+   * @brief Alignment every cell of a segment (slabs included) is guaranteed to have.
+   * @param sg Segment index.
+   * @return The largest power of 2 dividing the cell size, at most MEMPOOL_ALIGN.
+   */
+  uint8_t cell_align(uint8_t sg);
+
+  /**
+   * @brief Allocates a cell and constructs an object of type T in it.
+   * @tparam T Type of the object.
+   * @param args Constructor arguments, perfectly forwarded.
+   * @return Pointer to the object, or nullptr if allocation fails.
+   * @note The object must be released using destroy.
+   */
+  template <typename T, typename... Args>
+  T* create(Args&&... args);
+
+  /**
+   * @brief Destroys an object made by create and releases its cell.
+   * @tparam T Type of the object.
+   * @param ptr Pointer returned by create (nullptr is ignored).
+   */
+  template <typename T>
+  void destroy(T* ptr);
+
+  /**
+   * @brief Allocates a memory block of the specified size and clears it to zero.
+   * @param size Size of the memory block to allocate (in bytes).
+   * @return Pointer to the zeroed memory, or nullptr if allocation fails.
+   * @details The whole cell is cleared with aligned word stores, unrolled per segment size.
+   */
+  uint8_t* alloc_zeroed(uint16_t size);
+
+  /**
+   * @brief Template method to allocate zeroed memory for an array of type T.
+   * @tparam T Type of the elements to allocate.
+   * @param count Number of elements to allocate.
+   * @return Pointer to the zeroed memory, or nullptr if allocation fails or the size overflows 16 bits.
+   * @note The returned pointer must be released using release<T>.
+   */
+  template <typename T>
+  T* alloc_zeroed(uint8_t count);
+
   /**
    * @brief Releases a previously allocated memory block.
    * @param ptr Pointer to the memory block to release.
    * @note The pointer must be a valid address returned by alloc, otherwise behavior is undefined.
+   *       Pointers outside the pool's cells are passed to the upstream allocator when one is set.
    */
   void release(uint8_t* ptr);
 
+  /**
+   * @brief Releases a block whose allocation size is known.
+   * @param ptr Pointer to the memory block.
+   * @param size Size passed to alloc.
+   * @details The size selects the segment to check first, skipping the address search when the block was
+   *          not spilled.
+   */
+  void release(uint8_t* ptr, uint16_t size);
+
+  /**
+   * @brief Releases a block of the pool's own memory whose allocation size is known.
+   * @param ptr Pointer to the memory block.
+   * @param size Size passed to the allocation.
+   * @param align Alignment passed to the allocation.
+   * @return True if the pool owned and released the block, false if it is an upstream block or foreign pointer.
+   * @details Blocks of the segment fitting size at align are released without any search; other pointers are
+   *          looked up once, so callers need no separate owns() check before releasing.
+   */
+  bool release_pooled(uint8_t* ptr, uint16_t size, uint16_t align = 1);
+
+  /**
+   * @brief Releases several blocks with one pool lock.
+   * @param ptrs Pointers returned by alloc (nullptr entries are skipped).
+   * @param count Number of pointers.
+   * @details Cells of the segments are freed under a single mutex acquisition; slab cells and blocks of the
+   *          other allocators are then released one by one.
+   */
+  void release_batch(void* const* ptrs, uint16_t count);
+
+  /**
+   * @brief Allocates one contiguous block of adjacent cells inside a segment.
+   * @param size Size of the memory block to allocate (in bytes).
+   * @param cell_size Cell size of the segment to carve the span from (0 selects the largest segment).
+   * @return Pointer to the first cell of the span, or nullptr if no run of free cells is long enough.
+   * @details Requests that fit one cell of the largest segment are served by alloc. Spans are not available
+   *          in MEMPOOL_ENGINE_FREELIST segments. Requests no segment can serve go to the buddy or TLSF
+   *          allocator, then to upstream.
+   * @note The block must be released with release_span and the same size.
+   */
+  uint8_t* alloc_span(uint16_t size, uint16_t cell_size = 0);
+
+  /**
+   * @brief Allocates a span of the largest segment, or any block, aligned to a given boundary.
+   * @param size Size of the memory block to allocate (in bytes).
+   * @param align Required alignment (power of 2).
+   * @return Pointer to the block, or nullptr if no aligned block is available.
+   * @details Sizes that fit one cell, and spans the largest segment cannot align, are served by alloc_aligned.
+   * @note The block must be released with release_span and the same size.
+   */
+  uint8_t* alloc_span_aligned(uint16_t size, uint16_t align);
+
+  /**
+   * @brief Releases a block allocated by alloc_span.
+   * @param ptr Pointer returned by alloc_span.
+   * @param size Size passed to alloc_span.
+   */
+  void release_span(uint8_t* ptr, uint16_t size);
+
   /**
    * @brief Template method to release a previously allocated memory block of type T.
    * @tparam T Type of the elements to release.
@@ -110,14 +378,135 @@ class mempool {
    */
   uint16_t max_segment_size();
 
+  /**
+   * @brief Sets the upstream allocator serving requests the pool cannot.
+   * @param upstream Allocator hooks (copied), or nullptr to disable the fallback.
+   * @details Oversize requests and requests finding every allowed segment full are passed to upstream.alloc.
+   *          release() hands pointers outside the pool's cells to upstream.free.
+   */
+  void set_upstream(const mempool_upstream* upstream);
+
+  /**
+   * @brief Adds a buddy allocator for variable-size blocks above the largest fixed cell size.
+   * @param size Size of the buddy buffer in bytes.
+   * @param min_block Smallest buddy block (power of 2).
+   * @param region Region providing the buffer (index into the table passed to begin).
+   * @return True if the buffer was allocated, false if the pool is not initialized, a buddy is already set,
+   *         the region cannot provide the memory or the pool registry is full.
+   * @details alloc() serves sizes above max_segment_size() from power-of-two blocks of the buddy buffer in
+   *          O(log n), before falling back to the upstream allocator. release() merges freed blocks with
+   *          their buddies.
+   */
+  bool set_buddy(uint32_t size, uint16_t min_block = MEMPOOL_BUDDY_MIN_BLOCK, uint8_t region = 0);
+
+  /**
+   * @brief Adds a TLSF allocator serving the requests the fixed segments miss in constant time.
+   * @param size Size of the TLSF buffer in bytes.
+   * @param region Region providing the buffer (index into the table passed to begin).
+   * @return True if the buffer was allocated, false if the pool is not initialized, a TLSF allocator is
+   *         already set, the region cannot provide the memory or the pool registry is full.
+   * @details alloc() turns to it when every allowed segment is full and for sizes above max_segment_size()
+   *          the buddy allocator cannot serve, before falling back to the upstream allocator. Allocation and
+   *          release have a bounded worst case, unlike the system heap.
+   */
+  bool set_tlsf(uint32_t size, uint8_t region = 0);
+
+  /**
+   * @brief Limits the total memory segments may take from upstream when growing.
+   * @param max_bytes Maximum bytes of all extra slabs together (0 means unlimited).
+   * @details Extra slabs are drawn from the upstream allocator, or from the system heap when none is set.
+   */
+  void set_growth_limit(uint32_t max_bytes);
+
+  /**
+   * @brief Returns every fully free extra slab to the allocator it came from.
+   * @details Slabs kept as spares by automatic trimming are released as well.
+   * @return Number of bytes handed back.
+   */
+  uint32_t trim();
+
+  /**
+   * @brief Enables releasing extra slabs as soon as they become fully free.
+   * @param low_water Free cells a segment must keep in its other cells before an empty slab is given up
+   *                  (MEMPOOL_TRIM_OFF disables automatic trimming).
+   * @param spare_slabs Number of given up slabs kept to be re-carved by any growing segment instead of
+   *                    being returned upstream.
+   */
+  void set_auto_trim(uint16_t low_water, uint8_t spare_slabs = 0);
+
+  /**
+   * @brief Sets how allocations fall back to larger segments when their own segment is full.
+   * @param policy Spill policy to apply.
+   * @param limit Class count for MEMPOOL_SPILL_CLASSES, byte limit for MEMPOOL_SPILL_WASTE.
+   */
+  void set_spill_policy(spill_policy policy, uint16_t limit = 0);
+
+  /**
+   * @brief Enables reference counts for segment cells.
+   * @return True if the counter arrays exist, false if the pool is not initialized or out of memory.
+   * @details Each segment, and each slab it has already grown, gets an out-of-line array with one counter byte
+   *          per cell. Slabs grown afterwards carry their own array. Cells allocated before the call start with
+   *          one reference. Blocks of the buddy, TLSF and upstream allocators have no counter.
+   */
+  bool enable_refcounts();
+
+  /**
+   * @brief Adds a reference to an allocated cell.
+   * @param ptr Pointer to the cell.
+   * @return True if the reference was added, false if ptr is not a used segment or slab cell with a counter,
+   *         or the cell already has 256 references.
+   * @details release() then only drops a reference; the cell is freed with its last one.
+   */
+  bool retain(void* ptr);
+
+  /**
+   * @brief Number of references to a cell.
+   * @param ptr Pointer to the cell.
+   * @return Reference count, 0 if ptr is not a used segment or slab cell with a counter.
+   */
+  uint16_t ref_count(const void* ptr);
+
+  /**
+   * @brief Records a checkpoint of the segment cell masks.
+   * @param m Mark receiving a snapshot of the masks (a previous snapshot is overwritten).
+   * @return True if the snapshot was taken, false if the pool is not initialized or out of memory.
+   * @details The first mark into m allocates the snapshot buffer (one word per mask word of the segments) from
+   *          the general heap; marking m again reuses it.
+   * @note The snapshot does not record who allocated a cell, so between mark and rollback the pool must be
+   *       used by the marking task alone; a dedicated pool is the simplest way to guarantee it.
+   */
+  bool mark(mempool_mark& m);
+
+  /**
+   * @brief Frees every segment cell that was free at the mark and is in use now.
+   * @param m Mark taken by this pool.
+   * @details The masks are restored word by word (current &= snapshot), so rolling back N allocations costs
+   *          one pass over the mask words instead of N release calls. Free-list segments push the freed cells
+   *          back onto their list. Cells released since the mark stay free; blocks in extra slabs or from the
+   *          buddy, TLSF and upstream allocators are not tracked by the snapshot and must be released
+   *          individually.
+   * @warning Cells other tasks allocated since the mark are freed too, while they still use them.
+   */
+  void rollback(const mempool_mark& m);
+
  private:
-  bool _initialized = false;         ///< Flag indicating if the pool is initialized.
-  uint8_t* _buffer = nullptr;        ///< Buffer for memory pool.
-  uint32_t _buffer_size = 0;         ///< Total size of the buffer in bytes.
-  uint16_t _pool_size = 0;           ///< Size of the pool buffer in 32-bit words.
-  uint32_t* _pool_buffer = nullptr;  ///< Buffer for pool allocation masks.
-  uint32_t** _pool_ptr = nullptr;    ///< Pointers to pool mask starts for each segment.
-  uint8_t** _segment_ptr = nullptr;  ///< Pointers to segment starts in _buffer.
+  bool _initialized = false;               ///< Flag indicating if the pool is initialized.
+  mempool_region* _regions = nullptr;      ///< Regions providing segment memory.
+  uint8_t _region_count = 0;               ///< Number of regions.
+  bool _custom_regions = false;            ///< Whether regions were passed to begin.
+  uint8_t** _region_buffer = nullptr;      ///< Buffer of each region holding its segments.
+  uint32_t* _region_size = nullptr;        ///< Size of each region buffer in bytes.
+  uint8_t* _segment_region = nullptr;      ///< Region index of each segment.
+  uint8_t* _segment_order = nullptr;       ///< Segment indices sorted by address.
+  segment_engine* _segment_engine = nullptr;  ///< Allocation engine of each segment.
+  uint16_t* _free_head = nullptr;          ///< First free list cell of each segment (MEMPOOL_ENGINE_FREELIST only).
+  uint16_t* _cursor = nullptr;             ///< Search cursor of each segment (MEMPOOL_ENGINE_NEXTFIT only).
+  uint32_t _pool_size = 0;               ///< Size of the pool buffer in mask words.
+  mempool_word* _pool_buffer = nullptr;  ///< Buffer for pool allocation masks.
+  mempool_word** _pool_ptr = nullptr;    ///< Pointers to pool mask starts for each segment.
+  uint8_t* _refs_buffer = nullptr;       ///< Extra reference counts of all segment cells.
+  uint8_t** _refs_ptr = nullptr;         ///< Pointers to the reference counts of each segment.
+  uint8_t** _segment_ptr = nullptr;  ///< Pointers to segment starts in their region buffer.
 
   uint16_t _max_segment_size = 0;      ///< Maximum segment size in bytes.
   uint16_t* _segment_sizes = nullptr;  ///< Array of segment sizes in bytes.
@@ -125,10 +514,33 @@ class mempool {
   uint32_t* _magic_number = nullptr;   ///< Magic numbers for fast division when segment size is not a power of 2.
   uint8_t* _segment_shift = nullptr;   ///< Shift values for fast division when segment size is a power of 2.
 
+  mempool_slab** _slabs = nullptr;  ///< Chains of extra slabs for each segment.
+  uint16_t* _grow_count = nullptr;   ///< Cells per extra slab for each segment.
+  uint8_t* _grow_slabs = nullptr;    ///< Maximum number of extra slabs for each segment.
+  uint8_t* _slab_count = nullptr;    ///< Current number of extra slabs for each segment.
+  uint32_t _grow_limit = 0;          ///< Maximum bytes of all extra slabs (0 means unlimited).
+  uint32_t _grown_bytes = 0;         ///< Bytes currently held by extra slabs (spares included).
+  mempool_slab* _spare = nullptr;    ///< Empty slabs kept for re-carving by any segment.
+  uint8_t _spare_count = 0;          ///< Number of spare slabs.
+  uint8_t _spare_limit = 0;          ///< Maximum number of spare slabs.
+  uint16_t _trim_low_water = MEMPOOL_TRIM_OFF;  ///< Free cells kept before an empty slab is given up.
+
   uint8_t _segment_count = 0;          ///< Number of segments.
   int16_t* _segment_lookup = nullptr;  ///< Lookup table for segment selection.
   uint16_t _segment_lookup_count = 0;  ///< Number of entries in the segment lookup table.
 
+  spill_policy _spill_policy = MEMPOOL_SPILL_ANY;  ///< Fallback policy for full segments.
+  uint16_t _spill_limit = 0;                       ///< Limit parameter of the spill policy.
+
+  mempool_upstream _upstream = {nullptr, nullptr, nullptr};  ///< Fallback allocator, disabled when alloc is null.
+
+  mempool_buddy _buddy;                ///< Buddy allocator for sizes above the fixed cells.
+  uint8_t* _buddy_buffer = nullptr;    ///< Buffer of the buddy allocator.
+  uint8_t _buddy_region = 0;           ///< Region that provided the buddy buffer.
+  mempool_tlsf _tlsf;                  ///< TLSF allocator for requests missing the fixed cells.
+  uint8_t* _tlsf_buffer = nullptr;     ///< Buffer of the TLSF allocator.
+  uint8_t _tlsf_region = 0;            ///< Region that provided the TLSF buffer.
+
   SemaphoreHandle_t _mutex = nullptr;
   /**
    * @brief Finds the next segment with size greater than current.
@@ -139,6 +551,21 @@ class mempool {
    */
   uint8_t _get_next_segment(segment* arr, uint8_t count, uint16_t current);
 
+  /**
+   * @brief Compares segments by address for the release search order.
+   * @param a Segment index.
+   * @param b Segment index.
+   * @return True if a sorts before b.
+   */
+  bool _segment_before(uint8_t a, uint8_t b);
+
+  /**
+   * @brief Finds the segment whose cells contain a pointer.
+   * @param ptr Pointer to look up.
+   * @return Segment index, or -1 if ptr is not in any segment's own cells.
+   */
+  int16_t _find_segment(const uint8_t* ptr);
+
   /**
    * @brief Looks up the segment suitable for a given size.
    * @param size Size to find a segment for (in bytes).
@@ -147,20 +574,368 @@ class mempool {
   int16_t _lookup_segment(uint16_t size);
 
   /**
-   * @brief Prepares a bit mask for a given cell count.
-   * @param c Number of cells.
-   * @return Bit mask with the first c bits set to 0 (indicating free cells) and the rest to 1.
+   * @brief Allocates a cell for the given size and reports the segment it came from.
+   * @param size Size of the memory block to allocate (in bytes).
+   * @param sg Receives the index of the segment that served the request.
+   * @param align Required alignment; segments whose cells are less aligned are skipped.
+   * @return Pointer to the allocated memory, or nullptr if allocation fails.
+   */
+  uint8_t* _alloc(uint16_t size, uint8_t& sg, uint16_t align = 1);
+
+  /**
+   * @brief alloc_pooled without the failure count, for callers that fall back to upstream.
+   */
+  uint8_t* _alloc_pooled(uint16_t size, uint16_t align);
+
+  /**
+   * @brief Initializes the pool masks of a segment or slab (0 bits indicate free cells).
+   * @param pp Pool masks (header masks followed by cell masks).
+   * @param count Number of cells.
+   */
+  void _init_masks(mempool_word* pp, uint16_t count);
+
+  /**
+   * @brief Marks a cell as used, and its cell word as full in the header when no free cell is left in it.
+   * @param pp Pool masks (header masks followed by cell masks).
+   * @param headers Number of header words.
+   * @param cell Cell index.
+   */
+  void _mark_cell(mempool_word* pp, uint16_t headers, uint16_t cell);
+
+  /**
+   * @brief Marks the first free cell in the pool masks as used.
+   * @param pp Pool masks (header masks followed by cell masks).
+   * @param count Number of cells.
+   * @return Index of the taken cell, or -1 if all cells are used.
+   */
+  int32_t _take_cell(mempool_word* pp, uint16_t count);
+
+  /**
+   * @brief Marks the first run of k free cells in the pool masks as used.
+   * @param pp Pool masks (header masks followed by cell masks).
+   * @param count Number of cells.
+   * @param k Number of adjacent cells.
+   * @return Index of the first cell of the run, or -1 if there is no such run.
+   */
+  int32_t _take_span(mempool_word* pp, uint16_t count, uint16_t k);
+
+  /**
+   * @brief Marks k adjacent cells as used.
+   * @param pp Pool masks (header masks followed by cell masks).
+   * @param headers Number of header words.
+   * @param start First cell.
+   * @param k Number of cells.
+   */
+  void _mark_span(mempool_word* pp, uint16_t headers, uint16_t start, uint16_t k);
+
+  /**
+   * @brief Converts a byte offset within a segment or slab to a cell index.
+   * @param sg Segment index.
+   * @param offset Byte offset from the first cell.
+   * @return Cell index.
+   */
+  uint32_t _cell_index(uint8_t sg, uint32_t offset);
+
+  /**
+   * @brief Takes a free cell of a segment or slab with the segment's engine.
+   * @param sg Segment index.
+   * @param data First cell.
+   * @param pp Pool masks.
+   * @param count Number of cells.
+   * @param head Free list head.
+   * @param cursor Next fit search cursor.
+   * @return Index of the taken cell, or -1 if all cells are used.
+   */
+  int32_t _take(uint8_t sg, uint8_t* data, mempool_word* pp, uint16_t count, uint16_t& head, uint16_t& cursor);
+
+  /**
+   * @brief Marks the first free cell at or after the cursor as used, wrapping around, and advances the cursor.
+   * @param pp Pool masks (header masks followed by cell masks).
+   * @param count Number of cells.
+   * @param cursor Cell the search starts at, set past the taken cell.
+   * @return Index of the taken cell, or -1 if all cells are used.
+   */
+  int32_t _take_next_fit(mempool_word* pp, uint16_t count, uint16_t& cursor);
+
+  /**
+   * @brief Returns a cell of a segment or slab with the segment's engine.
+   * @param sg Segment index.
+   * @param data First cell.
+   * @param pp Pool masks.
+   * @param count Number of cells.
+   * @param cell Cell index.
+   * @param head Free list head.
+   * @return True if the cell was in use, false if it was already free.
+   */
+  bool _put(uint8_t sg, uint8_t* data, mempool_word* pp, uint16_t count, uint16_t cell, uint16_t& head);
+
+  /**
+   * @brief Threads all cells of a free list segment or slab into its free list.
+   * @param sg Segment index.
+   * @param data First cell.
+   * @param count Number of cells.
+   * @param head Receives the free list head (MEMPOOL_NO_CELL for other engines).
+   */
+  void _init_free_list(uint8_t sg, uint8_t* data, uint16_t count, uint16_t& head);
+
+  /**
+   * @brief Takes a free cell of a segment, growing it by a slab if needed. Must be called with the mutex held.
+   * @param sg Segment index.
+   * @return Pointer to the cell, or nullptr if the segment is full and cannot grow.
    */
-  uint32_t _prepare_mask(uint8_t c);
+  uint8_t* _take_from_segment(uint8_t sg);
+
+  /**
+   * @brief Adds an extra slab to a segment. Must be called with the mutex held.
+   * @param sg Segment index.
+   * @return The new slab, or nullptr if growth is disabled, limited or upstream failed.
+   */
+  mempool_slab* _grow(uint8_t sg);
+
+  /**
+   * @brief Counts the free cells in pool masks.
+   * @param pp Pool masks (header mask followed by cell masks).
+   * @param count Number of cells.
+   * @return Number of free cells.
+   */
+  uint16_t _free_cells(const mempool_word* pp, uint16_t count);
+
+  /**
+   * @brief Frees the cells of one segment selected by a mask word difference.
+   * @param sg Segment index.
+   * @param word Cell word index.
+   * @param bits Used cells of the word to free.
+   */
+  void _put_word(uint8_t sg, uint16_t word, mempool_word bits);
+
+  /**
+   * @brief Unlinks a slab from its segment and keeps it as spare or returns it upstream. Must be called with the mutex held.
+   * @param sg Segment index.
+   * @param link Link pointing to the slab.
+   * @param keep Whether the slab may be kept as spare.
+   */
+  void _drop_slab(uint8_t sg, mempool_slab** link, bool keep);
+
+  /**
+   * @brief Applies the low-water policy to a slab that just became empty. Must be called with the mutex held.
+   * @param sg Segment index.
+   * @param link Link pointing to the empty slab.
+   */
+  void _auto_trim(uint8_t sg, mempool_slab** link);
+
+  /**
+   * @brief Returns the cells of a block to a segment or slab.
+   * @param sg Segment index.
+   * @param data First cell.
+   * @param pp Pool masks.
+   * @param count Number of cells.
+   * @param cell First cell of the block.
+   * @param size Size of a span in bytes, 0 for a single cell.
+   * @param head Free list head.
+   * @param refs Extra reference counts of the cells, or nullptr.
+   * @return Number of cells freed (0 if the cell was free or only lost a reference).
+   */
+  uint16_t _put_cells(uint8_t sg, uint8_t* data, mempool_word* pp, uint16_t count, uint16_t cell, uint16_t size,
+                      uint16_t& head, uint8_t* refs);
+
+  /**
+   * @brief Finds the reference counter of a used cell. Must be called with the mutex held.
+   * @param ptr Pointer to the cell.
+   * @return Counter of the cell, or nullptr if ptr is not a used cell with a counter.
+   */
+  uint8_t* _ref_counter(const uint8_t* ptr);
+
+  /**
+   * @brief Releases a single cell or a span.
+   * @param ptr Pointer to release.
+   * @param size Size of a span in bytes, 0 for a single cell.
+   */
+  void _release(uint8_t* ptr, uint16_t size);
+
+  /**
+   * @brief Releases a pointer outside the segments' own cells: a slab cell or a buddy or TLSF block.
+   * @param ptr Pointer to release.
+   * @param size Size of a span in bytes, 0 for a single cell.
+   * @return True if the pool owned ptr, false for upstream blocks and foreign pointers (left untouched).
+   */
+  bool _release_outside(uint8_t* ptr, uint16_t size);
+
+  /**
+   * @brief Serves a request from the upstream allocator.
+   * @param size Size of the memory block to allocate (in bytes).
+   * @return Pointer to the allocated memory, or nullptr if there is no upstream or it failed.
+   * @details Callers try it last, so a miss here is what counts as a failed allocation (alloc_pooled, which
+   *          never reaches upstream, counts its own).
+   */
+  uint8_t* _alloc_upstream(uint16_t size);
+
+  /**
+   * @brief Serves a request from the variable-size engines.
+   * @param size Size of the memory block to allocate (in bytes).
+   * @return Pointer to the allocated memory, or nullptr if no engine can serve the size.
+   */
+  uint8_t* _alloc_variable(uint16_t size);
+
+  /**
+   * @brief Returns the last segment an allocation may spill into under the current policy.
+   * @param first Index of the best fitting segment.
+   * @param size Requested size in bytes.
+   * @return Index of the last segment to try.
+   */
+  uint8_t _spill_last_segment(uint8_t first, uint16_t size);
+
+  /**
+   * @brief Clears a whole cell with aligned word stores.
+   * @param p Pointer to the cell (aligned to SEGMENT_STEP).
+   * @param size Cell size of the segment in bytes.
+   */
+  static void _zero_cell(uint8_t* p, uint16_t size);
+
+  /**
+   * @brief Rounds a byte count up to a multiple of MEMPOOL_ALIGN.
+   */
+  static uint32_t _align_up(uint32_t n) { return (n + MEMPOOL_ALIGN - 1) & ~static_cast<uint32_t>(MEMPOOL_ALIGN - 1); }
+
+  /**
+   * @brief Rounds a pointer up to a MEMPOOL_ALIGN boundary.
+   */
+  static uint8_t* _align_ptr(uint8_t* p) {
+    uintptr_t mask = MEMPOOL_ALIGN - 1;
+    return reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(p) + mask) & ~mask);
+  }
+
 
 #ifdef MEMPOOL_STATISTIC
   uint16_t* _max_cells_used = nullptr;      ///< Maximum cells used per segment (debug only).
   uint32_t _total_allocs = 0;               ///< Total number of allocations (debug only).
   uint32_t _failed_allocs = 0;              ///< Number of failed allocations (debug only).
+  uint32_t _upstream_allocs = 0;            ///< Allocations served by the upstream allocator (debug only).
+  uint32_t _buddy_allocs = 0;               ///< Allocations served by the buddy allocator (debug only).
+  uint32_t _tlsf_allocs = 0;                ///< Allocations served by the TLSF allocator (debug only).
   uint32_t* _allocs_per_segment = nullptr;  ///< Allocations per segment (debug only).
+  uint32_t* _spills_per_segment = nullptr;  ///< Allocations spilled out of each segment (debug only).
+  uint16_t* _cells_used = nullptr;          ///< Cells currently used per segment (debug only).
 #endif
 };
 
+/**
+ * @brief Snapshot of a pool's segment cell masks taken by mempool::mark.
+ */
+class mempool_mark {
+ public:
+  mempool_mark() = default;
+  ~mempool_mark();
+  mempool_mark(const mempool_mark&) = delete;
+  mempool_mark& operator=(const mempool_mark&) = delete;
+
+  /**
+   * @brief Checks whether the mark holds a snapshot.
+   */
+  bool valid() const { return _words != nullptr; }
+
+  /**
+   * @brief Drops the snapshot.
+   */
+  void clear();
+
+ private:
+  friend class mempool;
+  const mempool* _pool = nullptr;  ///< Pool the snapshot was taken from.
+  mempool_word* _words = nullptr;  ///< Copy of the pool masks.
+  uint32_t _size = 0;              ///< Number of words in the snapshot.
+};
+
+/**
+ * @brief RAII checkpoint rolling back every segment cell allocated during its lifetime.
+ * @details Error paths can simply return: the destructor calls mempool::rollback unless commit() was called.
+ * @warning The scope needs exclusive use of the pool: cells any other task allocates from it during the
+ *          scope's lifetime are freed by the rollback as well. Give the scope a dedicated pool.
+ */
+class mempool_scope {
+ public:
+  /**
+   * @brief Constructor, marks the pool (allocating the snapshot buffer from the general heap).
+   * @param pool Pool to checkpoint.
+   */
+  explicit mempool_scope(mempool& pool);
+
+  /**
+   * @brief Destructor, rolls the pool back to the mark unless committed.
+   */
+  ~mempool_scope();
+
+  mempool_scope(const mempool_scope&) = delete;
+  mempool_scope& operator=(const mempool_scope&) = delete;
+
+  /**
+   * @brief Keeps the allocations made in the scope.
+   */
+  void commit() { _mark.clear(); }
+
+  /**
+   * @brief Rolls back now and starts a new checkpoint.
+   */
+  void rollback();
+
+  /**
+   * @brief Checks whether the checkpoint was taken.
+   */
+  bool valid() const { return _mark.valid(); }
+
+ private:
+  mempool& _pool;      ///< Checkpointed pool.
+  mempool_mark _mark;  ///< Snapshot taken on construction.
+};
+
+/**
+ * @brief Object pool for one type, drawing cells from the segment fitting sizeof(T) at alignof(T).
+ * @tparam T Type of the objects.
+ * @details The segment is looked up once and cached, so create() takes a cell straight from it without the
+ *          per-call size lookup. When the segment is full the request goes through mempool::alloc_aligned.
+ */
+template <typename T>
+class typed_pool {
+  static_assert(sizeof(T) <= 0xFFFF, "typed_pool: type too large for a pool allocation");
+
+ public:
+  /**
+   * @brief Constructor.
+   * @param pool Pool providing the cells.
+   */
+  explicit typed_pool(mempool& pool) : _pool(pool) {}
+
+  /**
+   * @brief Allocates uninitialized storage for one T.
+   * @return Pointer to the storage, or nullptr if allocation fails.
+   */
+  T* alloc();
+
+  /**
+   * @brief Allocates a cell and constructs a T in it.
+   * @param args Constructor arguments, perfectly forwarded.
+   * @return Pointer to the object, or nullptr if allocation fails.
+   */
+  template <typename... Args>
+  T* create(Args&&... args);
+
+  /**
+   * @brief Destroys an object made by create and releases its cell.
+   * @param ptr Pointer returned by create (nullptr is ignored).
+   */
+  void destroy(T* ptr);
+
+  /**
+   * @brief Releases storage from alloc without running a destructor.
+   * @param ptr Pointer returned by alloc.
+   */
+  void release(T* ptr) { _pool.release(ptr); }
+
+ private:
+  mempool& _pool;        ///< Pool providing the cells.
+  int16_t _segment = -1;  ///< Cached segment fitting sizeof(T) at alignof(T), -1 until looked up.
+};
+
 #include "mempool.tpp"
+#include "mempool_registry.h"
 
 extern mempool mem;
\ No newline at end of file
@@ -1,4 +1,8 @@
 #pragma once
+#include <string.h>
+
+#include <type_traits>
+
 #include "mempool.h"
 
 /**
@@ -10,8 +14,26 @@
  */
 template <typename T>
 T* mempool::alloc(uint8_t count) {
+  if (sizeof(T) * count > 0xFFFF) return nullptr;
   uint16_t size = sizeof(T) * count;
-  uint8_t* b = alloc(size);
+  uint8_t* b = alloc_aligned(size, alignof(T));
+  return reinterpret_cast<T*>(b);
+}
+
+/**
+ * @brief Allocates zeroed memory for an array of type T.
+ * @tparam T Type of the elements to allocate.
+ * @param count Number of elements to allocate.
+ * @return Pointer to the zeroed memory, or nullptr if allocation fails.
+ * @note The returned pointer must be released using release<T>.
+ */
+template <typename T>
+T* mempool::alloc_zeroed(uint8_t count) {
+  if (sizeof(T) * count > 0xFFFF) return nullptr;
+  uint16_t size = sizeof(T) * count;
+  if (alignof(T) <= 4) return reinterpret_cast<T*>(alloc_zeroed(size));
+  uint8_t* b = alloc_aligned(size, alignof(T));
+  if (b) memset(b, 0, size);
   return reinterpret_cast<T*>(b);
 }
 
@@ -27,4 +49,68 @@ void mempool::release(T* ptr) {
     return;
   }
   release(reinterpret_cast<uint8_t*>(ptr));
-}
\ No newline at end of file
+}
+/**
+ * @brief Allocates a cell and constructs an object of type T in it.
+ * @tparam T Type of the object.
+ * @param args Constructor arguments, perfectly forwarded.
+ * @return Pointer to the object, or nullptr if allocation fails.
+ */
+template <typename T, typename... Args>
+T* mempool::create(Args&&... args) {
+  static_assert(sizeof(T) <= 0xFFFF, "create: type too large for a pool allocation");
+  uint8_t* b = alloc_aligned(sizeof(T), alignof(T));
+  if (!b) return nullptr;
+  return new (b) T(std::forward<Args>(args)...);
+}
+
+/**
+ * @brief Destroys an object made by create and releases its cell.
+ * @tparam T Type of the object.
+ * @param ptr Pointer returned by create.
+ */
+template <typename T>
+void mempool::destroy(T* ptr) {
+  if (!ptr) return;
+  ptr->~T();
+  release(reinterpret_cast<uint8_t*>(const_cast<typename std::remove_cv<T>::type*>(ptr)));
+}
+
+/**
+ * @brief Allocates uninitialized storage for one T from the cached segment.
+ * @tparam T Type of the objects.
+ * @return Pointer to the storage, or nullptr if allocation fails.
+ */
+template <typename T>
+T* typed_pool<T>::alloc() {
+  if (_segment < 0) _segment = _pool.segment_for(sizeof(T), alignof(T));
+  uint8_t* b = _segment >= 0 ? _pool.alloc_from(_segment) : nullptr;
+  if (!b) b = _pool.alloc_aligned(sizeof(T), alignof(T));
+  return reinterpret_cast<T*>(b);
+}
+
+/**
+ * @brief Allocates a cell and constructs a T in it.
+ * @tparam T Type of the objects.
+ * @param args Constructor arguments, perfectly forwarded.
+ * @return Pointer to the object, or nullptr if allocation fails.
+ */
+template <typename T>
+template <typename... Args>
+T* typed_pool<T>::create(Args&&... args) {
+  T* p = alloc();
+  if (!p) return nullptr;
+  return new (p) T(std::forward<Args>(args)...);
+}
+
+/**
+ * @brief Destroys an object made by create and releases its cell.
+ * @tparam T Type of the objects.
+ * @param ptr Pointer returned by create.
+ */
+template <typename T>
+void typed_pool<T>::destroy(T* ptr) {
+  if (!ptr) return;
+  ptr->~T();
+  _pool.release(ptr);
+}
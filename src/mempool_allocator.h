@@ -0,0 +1,97 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+
+#include "mempool.h"
+
+/**
+ * @brief Standard allocator drawing container nodes and small buffers from a mempool.
+ * @tparam T Element type.
+ * @details Requests up to max_segment_size() are served by alloc_pooled (segments, buddy, TLSF), from a
+ *          segment whose cells meet alignof(T); larger requests and requests the pool cannot serve go to the
+ *          global operator new. deallocate uses the element count to release pool blocks with release_pooled,
+ *          which finds them without a separate owns() search, and hands every other block back to operator
+ *          delete. Copies and rebound copies share the pool and compare equal.
+ */
+template <typename T>
+class mempool_allocator {
+ public:
+  typedef T value_type;            ///< Element type.
+  typedef T* pointer;              ///< Pointer type.
+  typedef const T* const_pointer;  ///< Const pointer type.
+  typedef size_t size_type;        ///< Size type.
+  typedef ptrdiff_t difference_type;  ///< Difference type.
+
+  /**
+   * @brief Rebinds the allocator to another element type.
+   */
+  template <typename U>
+  struct rebind {
+    typedef mempool_allocator<U> other;  ///< Allocator for U sharing the pool.
+  };
+
+  /**
+   * @brief Constructor.
+   * @param pool Pool serving the allocations (the global pool by default).
+   */
+  mempool_allocator(mempool& pool = mem) noexcept : _pool(&pool) {}
+
+  /**
+   * @brief Converting constructor used by rebind.
+   */
+  template <typename U>
+  mempool_allocator(const mempool_allocator<U>& other) noexcept : _pool(other.pool()) {}
+
+  /**
+   * @brief Allocates storage for n elements.
+   * @param n Number of elements.
+   * @return Pointer to the storage.
+   */
+  T* allocate(size_t n);
+
+  /**
+   * @brief Releases storage from allocate.
+   * @param p Pointer returned by allocate.
+   * @param n Number of elements passed to allocate.
+   */
+  void deallocate(T* p, size_t n) noexcept;
+
+  /**
+   * @brief Pool serving the allocations.
+   */
+  mempool* pool() const noexcept { return _pool; }
+
+ private:
+  mempool* _pool;  ///< Pool serving the allocations.
+};
+
+template <typename T>
+T* mempool_allocator<T>::allocate(size_t n) {
+  size_t bytes = n * sizeof(T);
+  if (n > static_cast<size_t>(-1) / sizeof(T)) bytes = static_cast<size_t>(-1);
+  void* p = nullptr;
+  if (bytes <= _pool->max_segment_size()) p = _pool->alloc_pooled(static_cast<uint16_t>(bytes), alignof(T));
+  if (!p) p = ::operator new(bytes);
+  return static_cast<T*>(p);
+}
+
+template <typename T>
+void mempool_allocator<T>::deallocate(T* p, size_t n) noexcept {
+  size_t bytes = n * sizeof(T);
+  if (bytes > _pool->max_segment_size() ||
+      !_pool->release_pooled(reinterpret_cast<uint8_t*>(p), static_cast<uint16_t>(bytes), alignof(T))) {
+    ::operator delete(p);
+  }
+}
+
+template <typename T, typename U>
+bool operator==(const mempool_allocator<T>& a, const mempool_allocator<U>& b) noexcept {
+  return a.pool() == b.pool();
+}
+
+template <typename T, typename U>
+bool operator!=(const mempool_allocator<T>& a, const mempool_allocator<U>& b) noexcept {
+  return a.pool() != b.pool();
+}
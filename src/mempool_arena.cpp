@@ -0,0 +1,61 @@
+#include "mempool_arena.h"
+
+mempool_arena::mempool_arena(mempool& pool, uint16_t chunk_size)
+    : _pool(pool), _chunk_size(chunk_size ? chunk_size : MEMPOOL_ARENA_CHUNK) {}
+
+mempool_arena::~mempool_arena() {
+  reset();
+}
+
+uint8_t* mempool_arena::alloc(uint16_t size, uint8_t align) {
+  if (size == 0 || align == 0 || (align & (align - 1))) return nullptr;
+  uint8_t* p = _cur ? _align(_cur, align) : nullptr;
+  if (!p || p + size > _end) {
+    uint32_t need = sizeof(chunk) + align - 1 + size;
+    if (need > 0xFFFF) return nullptr;
+    if (need > _chunk_size) {
+      // Oversize blocks get a chunk of their own, the current chunk keeps being bumped
+      chunk* c = _take_chunk(need, false);
+      if (!c) return nullptr;
+      _used += size;
+      return _align(reinterpret_cast<uint8_t*>(c + 1), align);
+    }
+    if (!_take_chunk(_chunk_size, true)) return nullptr;
+    p = _align(_cur, align);
+  }
+  _used += p + size - _cur;
+  _cur = p + size;
+  return p;
+}
+
+mempool_arena::chunk* mempool_arena::_take_chunk(uint16_t size, bool current) {
+  chunk* c = reinterpret_cast<chunk*>(_pool.alloc_span(size));
+  if (!c) return nullptr;
+  c->size = size;
+  if (current || !_chunks) {
+    c->prev = _chunks;
+    _chunks = c;
+  } else {
+    // Keep the current chunk at the head so its remaining space stays reachable
+    c->prev = _chunks->prev;
+    _chunks->prev = c;
+  }
+  if (current) {
+    _cur = reinterpret_cast<uint8_t*>(c + 1);
+    _end = reinterpret_cast<uint8_t*>(c) + size;
+  }
+  _chunk_count++;
+  return c;
+}
+
+void mempool_arena::reset() {
+  while (_chunks) {
+    chunk* c = _chunks;
+    _chunks = c->prev;
+    _pool.release_span(reinterpret_cast<uint8_t*>(c), c->size);
+  }
+  _cur = nullptr;
+  _end = nullptr;
+  _used = 0;
+  _chunk_count = 0;
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mempool.h"
+
+#ifndef MEMPOOL_ARENA_CHUNK
+#define MEMPOOL_ARENA_CHUNK 256  ///< Default size of the chunks an arena takes from its pool in bytes.
+#endif
+
+/**
+ * @brief Monotonic bump allocator over chunks taken from a mempool.
+ * @details Chunks are cell spans (or variable-size blocks) of the pool, so one pool mutex round-trip serves
+ *          many small objects; allocation is a pointer bump within the current chunk. Objects are never freed
+ *          one by one: reset() returns every chunk to the pool at once.
+ * @note An arena is not synchronized and is meant to be used by one task at a time.
+ */
+class mempool_arena {
+ public:
+  /**
+   * @brief Constructor.
+   * @param pool Pool the chunks are taken from.
+   * @param chunk_size Size of each chunk in bytes (0 selects MEMPOOL_ARENA_CHUNK).
+   */
+  explicit mempool_arena(mempool& pool, uint16_t chunk_size = 0);
+
+  /**
+   * @brief Destructor, returns every chunk to the pool.
+   */
+  ~mempool_arena();
+
+  mempool_arena(const mempool_arena&) = delete;
+  mempool_arena& operator=(const mempool_arena&) = delete;
+
+  /**
+   * @brief Allocates a block by bumping the current chunk pointer.
+   * @param size Size of the memory block (in bytes).
+   * @param align Alignment of the block (power of 2).
+   * @return Pointer to the block, or nullptr if the pool cannot provide a chunk.
+   * @details Blocks too large for a chunk get a chunk of their own; the current chunk stays in use.
+   */
+  uint8_t* alloc(uint16_t size, uint8_t align = sizeof(void*));
+
+  /**
+   * @brief Template method to allocate an array of type T.
+   * @param count Number of elements.
+   * @return Pointer to the array, or nullptr if allocation fails or the size overflows.
+   */
+  template <typename T>
+  T* alloc(uint16_t count = 1);
+
+  /**
+   * @brief Releases every block at once and returns the chunks to the pool.
+   */
+  void reset();
+
+  /**
+   * @brief Number of bytes handed out since the last reset, alignment padding included.
+   */
+  uint32_t bytes_used() const { return _used; }
+
+  /**
+   * @brief Number of chunks currently held.
+   */
+  uint16_t chunk_count() const { return _chunk_count; }
+
+ private:
+  /**
+   * @brief Link at the start of each chunk.
+   */
+  struct chunk {
+    chunk* prev;    ///< Previously taken chunk.
+    uint16_t size;  ///< Size passed to alloc_span, needed to release the chunk.
+  };
+
+  /**
+   * @brief Takes a chunk from the pool and links it.
+   * @param size Chunk size in bytes, header included.
+   * @param current Whether the chunk becomes the one bumped by later allocations.
+   * @return The chunk, or nullptr if the pool cannot provide it.
+   */
+  chunk* _take_chunk(uint16_t size, bool current);
+
+  /**
+   * @brief Rounds a pointer up to an alignment (power of 2).
+   */
+  static uint8_t* _align(uint8_t* p, uint8_t align) {
+    uintptr_t mask = static_cast<uintptr_t>(align - 1);
+    return reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(p) + mask) & ~mask);
+  }
+
+  mempool& _pool;             ///< Pool providing the chunks.
+  uint16_t _chunk_size;       ///< Size of regular chunks.
+  chunk* _chunks = nullptr;   ///< Most recently taken chunk.
+  uint8_t* _cur = nullptr;    ///< Next free byte of the current chunk.
+  uint8_t* _end = nullptr;    ///< End of the current chunk.
+  uint32_t _used = 0;         ///< Bytes handed out since the last reset.
+  uint16_t _chunk_count = 0;  ///< Number of chunks held.
+};
+
+template <typename T>
+T* mempool_arena::alloc(uint16_t count) {
+  if (count == 0 || sizeof(T) > 0xFFFF / count) return nullptr;
+  return reinterpret_cast<T*>(alloc(sizeof(T) * count, alignof(T)));
+}
@@ -0,0 +1,169 @@
+#pragma once
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#ifndef MEMPOOL_WORD_BITS
+#if UINTPTR_MAX > 0xFFFFFFFF
+#define MEMPOOL_WORD_BITS 64  ///< Width of the pool mask words (64 on 64-bit targets).
+#else
+#define MEMPOOL_WORD_BITS 32  ///< Width of the pool mask words (32 on 32-bit targets).
+#endif
+#endif
+
+#ifndef MEMPOOL_SIMD_MIN_WORDS
+#define MEMPOOL_SIMD_MIN_WORDS 8  ///< Minimum number of mask words a scan must cover before the vector path is used.
+#endif
+
+/**
+ * @brief Word operations of the two-level pool masks.
+ * @tparam W Unsigned mask word type (uint32_t or uint64_t).
+ * @details Masks of n cells are laid out as [header words][cell words]. Cell words hold one bit per cell,
+ *          header words one bit per cell word; set bits mark used cells and full cell words.
+ */
+template <typename W>
+struct mempool_bitmap {
+  static const uint8_t bits = sizeof(W) * 8;              ///< Bits per word.
+  static const uint8_t shift = sizeof(W) == 8 ? 6 : 5;    ///< Log2 of bits.
+  static const W full = static_cast<W>(~static_cast<W>(0));  ///< Word with every bit set.
+
+  /**
+   * @brief Number of cell words covering a cell count.
+   */
+  static uint16_t words(uint16_t cells) { return (cells + bits - 1) >> shift; }
+
+  /**
+   * @brief Number of header words covering a cell count.
+   */
+  static uint16_t headers(uint16_t cells) { return (words(cells) + bits - 1) >> shift; }
+
+  /**
+   * @brief Index of the lowest set bit (w must not be 0).
+   */
+  static uint8_t ctz(W w) { return sizeof(W) == 8 ? __builtin_ctzll(w) : __builtin_ctz(w); }
+
+  /**
+   * @brief Number of leading zero bits (w must not be 0).
+   */
+  static uint8_t clz(W w) { return sizeof(W) == 8 ? __builtin_clzll(w) : __builtin_clz(w); }
+
+  /**
+   * @brief Number of set bits.
+   */
+  static uint8_t popcount(W w) { return sizeof(W) == 8 ? __builtin_popcountll(w) : __builtin_popcount(w); }
+
+  /**
+   * @brief Bit mask with the lowest c bits cleared and the rest set (0 for c == 0).
+   */
+  static W tail_mask(uint8_t c) { return c ? static_cast<W>(full << c) : 0; }
+
+  /**
+   * @brief Mask of n consecutive bits starting at bit b (b + n must not exceed bits).
+   */
+  static W range_mask(uint8_t b, uint8_t n) {
+    return static_cast<W>((n >= bits ? full : static_cast<W>((static_cast<W>(1) << n) - 1)) << b);
+  }
+
+  /**
+   * @brief Finds the first word that is not full.
+   * @param w Words to scan.
+   * @param from Index of the first word to check.
+   * @param n Number of words.
+   * @return Index of the first word in [from, n) with a cleared bit, or -1 if there is none.
+   */
+  static int32_t find_nonfull(const W* w, uint16_t from, uint16_t n) {
+    uint16_t i = from;
+#if defined(__AVX2__)
+    if (n - i >= MEMPOOL_SIMD_MIN_WORDS) {
+      const __m256i ones = _mm256_set1_epi8(-1);
+      for (; i + 32 / sizeof(W) <= n; i += 32 / sizeof(W)) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + i));
+        if (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, ones))) != 0xFFFFFFFF) break;
+      }
+    }
+#elif defined(__SSE2__)
+    if (n - i >= MEMPOOL_SIMD_MIN_WORDS) {
+      const __m128i ones = _mm_set1_epi8(-1);
+      for (; i + 16 / sizeof(W) <= n; i += 16 / sizeof(W)) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, ones)) != 0xFFFF) break;
+      }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    if (n - i >= MEMPOOL_SIMD_MIN_WORDS) {
+      for (; i + 16 / sizeof(W) <= n; i += 16 / sizeof(W)) {
+        uint32x4_t v = vld1q_u32(reinterpret_cast<const uint32_t*>(w + i));
+        if (vminvq_u32(v) != 0xFFFFFFFF) break;
+      }
+    }
+#endif
+    // Scalar tail, or the whole scan on targets without a vector unit
+    for (; i < n; i++) {
+      if (w[i] != full) return i;
+    }
+    return -1;
+  }
+
+  /**
+   * @brief Counts the set bits of a run of words.
+   * @param w Words to count.
+   * @param n Number of words.
+   * @return Total number of set bits.
+   */
+  static uint32_t count_set(const W* w, uint16_t n) {
+    uint16_t i = 0;
+    uint32_t total = 0;
+#if defined(__AVX2__)
+    if (n >= MEMPOOL_SIMD_MIN_WORDS) {
+      // Per-byte SWAR popcount, bytes summed into the four 64-bit lanes by SAD against zero
+      const __m256i m1 = _mm256_set1_epi8(0x55), m2 = _mm256_set1_epi8(0x33), m4 = _mm256_set1_epi8(0x0F);
+      __m256i acc = _mm256_setzero_si256();
+      for (; i + 32 / sizeof(W) <= n; i += 32 / sizeof(W)) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + i));
+        v = _mm256_sub_epi8(v, _mm256_and_si256(_mm256_srli_epi16(v, 1), m1));
+        v = _mm256_add_epi8(_mm256_and_si256(v, m2), _mm256_and_si256(_mm256_srli_epi16(v, 2), m2));
+        v = _mm256_and_si256(_mm256_add_epi8(v, _mm256_srli_epi16(v, 4)), m4);
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, _mm256_setzero_si256()));
+      }
+      uint64_t lanes[4];
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+      total = static_cast<uint32_t>(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    }
+#elif defined(__SSE2__)
+    if (n >= MEMPOOL_SIMD_MIN_WORDS) {
+      const __m128i m1 = _mm_set1_epi8(0x55), m2 = _mm_set1_epi8(0x33), m4 = _mm_set1_epi8(0x0F);
+      __m128i acc = _mm_setzero_si128();
+      for (; i + 16 / sizeof(W) <= n; i += 16 / sizeof(W)) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i));
+        v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi16(v, 1), m1));
+        v = _mm_add_epi8(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi16(v, 2), m2));
+        v = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi16(v, 4)), m4);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, _mm_setzero_si128()));
+      }
+      total = static_cast<uint32_t>(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    if (n >= MEMPOOL_SIMD_MIN_WORDS) {
+      for (; i + 16 / sizeof(W) <= n; i += 16 / sizeof(W)) {
+        total += vaddlvq_u8(vcntq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(w + i))));
+      }
+    }
+#endif
+    for (; i < n; i++) total += popcount(w[i]);
+    return total;
+  }
+};
+
+#if MEMPOOL_WORD_BITS == 64
+typedef uint64_t mempool_word;  ///< Pool mask word.
+#else
+typedef uint32_t mempool_word;  ///< Pool mask word.
+#endif
+
+typedef mempool_bitmap<mempool_word> mempool_bits;  ///< Mask operations for the configured word width.
@@ -0,0 +1,151 @@
+#include "mempool_buddy.h"
+
+#define BUDDY_USED 0x80  ///< Block order flag of allocated blocks.
+
+mempool_buddy::~mempool_buddy() {
+  clean();
+}
+
+void mempool_buddy::clean() {
+  if (_map) delete[] _map;
+  if (_block_order) delete[] _block_order;
+  _map = nullptr;
+  _block_order = nullptr;
+  _buffer = nullptr;
+  _size = 0;
+  _min_block = 0;
+  _min_shift = 0;
+  _orders = 0;
+  _nonempty = 0;
+  _free_bytes = 0;
+  for (uint8_t o = 0; o < MEMPOOL_BUDDY_MAX_ORDERS; o++) _free[o] = nullptr;
+}
+
+bool mempool_buddy::begin(uint8_t* buffer, uint32_t size, uint16_t min_block) {
+  clean();
+  if (!buffer || min_block < sizeof(node) || (min_block & (min_block - 1))) return false;
+  while ((1u << _min_shift) < min_block) _min_shift++;
+  _min_block = min_block;
+  _size = size & ~static_cast<uint32_t>(min_block - 1);
+  if (_size == 0) return false;
+  while (_orders < MEMPOOL_BUDDY_MAX_ORDERS && (static_cast<uint32_t>(min_block) << _orders) <= _size) _orders++;
+
+  // One bitmap per order with a bit for every block of that order
+  uint32_t map_size = 0;
+  for (uint8_t o = 0; o < _orders; o++) {
+    _map_offset[o] = map_size;
+    map_size += ((_size >> (_min_shift + o)) + mempool_bits::bits - 1) >> mempool_bits::shift;
+  }
+  _map = new mempool_word[map_size]{};
+  if (!_map) {
+    clean();
+    return false;
+  }
+  _block_order = new uint8_t[_size >> _min_shift]{};
+  if (!_block_order) {
+    clean();
+    return false;
+  }
+  _buffer = buffer;
+
+  // Cover the buffer with the largest aligned blocks that fit
+  for (uint32_t offset = 0; offset < _size;) {
+    uint8_t o = _orders - 1;
+    while (o > 0 && ((offset & ((static_cast<uint32_t>(min_block) << o) - 1)) ||
+                     offset + (static_cast<uint32_t>(min_block) << o) > _size)) {
+      o--;
+    }
+    _push(offset, o);
+    offset += static_cast<uint32_t>(min_block) << o;
+  }
+  _free_bytes = _size;
+  return true;
+}
+
+uint8_t* mempool_buddy::alloc(uint32_t size) {
+  if (!_buffer || size == 0 || size > max_block()) return nullptr;
+  uint8_t order = 0;
+  while ((static_cast<uint32_t>(_min_block) << order) < size) order++;
+
+  // Smallest order with a free block, found with one bit scan
+  uint32_t avail = _nonempty & ~((1u << order) - 1);
+  if (!avail) return nullptr;
+  uint8_t o = __builtin_ctz(avail);
+  uint32_t offset = reinterpret_cast<uint8_t*>(_free[o]) - _buffer;
+  _remove(offset, o);
+
+  // Split down to the requested order, the upper halves become free buddies
+  while (o > order) {
+    o--;
+    _push(offset + (static_cast<uint32_t>(_min_block) << o), o);
+  }
+  _block_order[offset >> _min_shift] = order | BUDDY_USED;
+  _free_bytes -= static_cast<uint32_t>(_min_block) << order;
+  return _buffer + offset;
+}
+
+bool mempool_buddy::release(uint8_t* ptr) {
+  if (!owns(ptr)) return false;
+  uint32_t offset = ptr - _buffer;
+  if (offset & (_min_block - 1)) return true;
+  uint8_t& entry = _block_order[offset >> _min_shift];
+  if (!(entry & BUDDY_USED)) return true;
+  uint8_t o = entry & ~BUDDY_USED;
+  entry = 0;
+  _free_bytes += static_cast<uint32_t>(_min_block) << o;
+
+  // Merge while the buddy is a free block of the same order
+  while (o + 1 < _orders) {
+    uint32_t block = static_cast<uint32_t>(_min_block) << o;
+    uint32_t buddy = offset ^ block;
+    if (buddy + block > _size || !_is_free(buddy, o)) break;
+    _remove(buddy, o);
+    offset &= ~block;
+    o++;
+  }
+  _push(offset, o);
+  return true;
+}
+
+uint32_t mempool_buddy::block_size(const uint8_t* ptr) const {
+  if (!owns(ptr)) return 0;
+  uint32_t offset = ptr - _buffer;
+  if (offset & (_min_block - 1)) return 0;
+  uint8_t entry = _block_order[offset >> _min_shift];
+  return (entry & BUDDY_USED) ? static_cast<uint32_t>(_min_block) << (entry & ~BUDDY_USED) : 0;
+}
+
+uint32_t mempool_buddy::largest_free() const {
+  return _nonempty ? static_cast<uint32_t>(_min_block) << (31 - __builtin_clz(_nonempty)) : 0;
+}
+
+void mempool_buddy::_push(uint32_t offset, uint8_t order) {
+  node* n = reinterpret_cast<node*>(_buffer + offset);
+  n->prev = nullptr;
+  n->next = _free[order];
+  if (n->next) n->next->prev = n;
+  _free[order] = n;
+  _nonempty |= 1u << order;
+  uint32_t bit = offset >> (_min_shift + order);
+  _map[_map_offset[order] + (bit >> mempool_bits::shift)] |= static_cast<mempool_word>(1)
+                                                            << (bit & (mempool_bits::bits - 1));
+}
+
+void mempool_buddy::_remove(uint32_t offset, uint8_t order) {
+  node* n = reinterpret_cast<node*>(_buffer + offset);
+  if (n->prev) {
+    n->prev->next = n->next;
+  } else {
+    _free[order] = n->next;
+  }
+  if (n->next) n->next->prev = n->prev;
+  if (!_free[order]) _nonempty &= ~(1u << order);
+  uint32_t bit = offset >> (_min_shift + order);
+  _map[_map_offset[order] + (bit >> mempool_bits::shift)] &= ~(static_cast<mempool_word>(1)
+                                                             << (bit & (mempool_bits::bits - 1)));
+}
+
+bool mempool_buddy::_is_free(uint32_t offset, uint8_t order) const {
+  uint32_t bit = offset >> (_min_shift + order);
+  return (_map[_map_offset[order] + (bit >> mempool_bits::shift)] >> (bit & (mempool_bits::bits - 1))) & 1;
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mempool_bitmap.h"
+
+#ifndef MEMPOOL_BUDDY_MIN_BLOCK
+#define MEMPOOL_BUDDY_MIN_BLOCK 256  ///< Default smallest buddy block in bytes (must be a power of 2).
+#endif
+
+#ifndef MEMPOOL_BUDDY_MAX_ORDERS
+#define MEMPOOL_BUDDY_MAX_ORDERS 16  ///< Maximum number of block orders (sizes min_block << 0 .. min_block << 15).
+#endif
+
+/**
+ * @brief Buddy system allocator for variable-size blocks carved from one buffer.
+ * @details Blocks are powers of two between min_block and the largest power of two fitting the buffer. Each order
+ *          keeps a doubly linked free list threaded through the free blocks and a bitmap with one bit per block
+ *          (set = free block of that order), so splitting and merging are O(log n) and the buddy of a released
+ *          block is checked with a single bit test. Internal fragmentation is bounded by half the block size.
+ * @note The allocator is not synchronized; mempool calls it with its own mutex held.
+ */
+class mempool_buddy {
+ public:
+  /**
+   * @brief Destructor, frees the bookkeeping arrays. The buffer itself belongs to the caller.
+   */
+  ~mempool_buddy();
+
+  /**
+   * @brief Initializes the allocator over a buffer.
+   * @param buffer Memory to carve blocks from.
+   * @param size Size of the buffer in bytes; a tail shorter than min_block is not used.
+   * @param min_block Smallest block size (power of 2, at least two pointers).
+   * @return True if initialization succeeds, false otherwise.
+   */
+  bool begin(uint8_t* buffer, uint32_t size, uint16_t min_block = MEMPOOL_BUDDY_MIN_BLOCK);
+
+  /**
+   * @brief Frees the bookkeeping arrays and detaches the buffer.
+   */
+  void clean();
+
+  /**
+   * @brief Allocates a block of at least size bytes.
+   * @param size Requested size in bytes.
+   * @return Pointer to the block, or nullptr if no free block is large enough.
+   */
+  uint8_t* alloc(uint32_t size);
+
+  /**
+   * @brief Releases a block and merges it with its free buddies.
+   * @param ptr Pointer returned by alloc.
+   * @return True if ptr lies in the buffer (blocks that are already free are ignored), false otherwise.
+   */
+  bool release(uint8_t* ptr);
+
+  /**
+   * @brief Checks whether a pointer lies in the buffer.
+   */
+  bool owns(const uint8_t* ptr) const { return _buffer && ptr >= _buffer && ptr < _buffer + _size; }
+
+  /**
+   * @brief Size of an allocated block.
+   * @param ptr Pointer returned by alloc.
+   * @return Block size in bytes, or 0 if ptr is not an allocated block.
+   */
+  uint32_t block_size(const uint8_t* ptr) const;
+
+  /**
+   * @brief Total size of the free blocks in bytes.
+   */
+  uint32_t free_bytes() const { return _free_bytes; }
+
+  /**
+   * @brief Size of the largest free block in bytes (0 if none).
+   */
+  uint32_t largest_free() const;
+
+  /**
+   * @brief Size of the largest block the allocator can ever return.
+   */
+  uint32_t max_block() const { return _orders ? static_cast<uint32_t>(_min_block) << (_orders - 1) : 0; }
+
+ private:
+  /**
+   * @brief Free list link stored in the first bytes of a free block.
+   */
+  struct node {
+    node* prev;  ///< Previous free block of the same order.
+    node* next;  ///< Next free block of the same order.
+  };
+
+  /**
+   * @brief Adds a block to the free list and bitmap of its order.
+   */
+  void _push(uint32_t offset, uint8_t order);
+
+  /**
+   * @brief Removes a block from the free list and bitmap of its order.
+   */
+  void _remove(uint32_t offset, uint8_t order);
+
+  /**
+   * @brief Tests the bitmap bit of a block.
+   */
+  bool _is_free(uint32_t offset, uint8_t order) const;
+
+  uint8_t* _buffer = nullptr;                      ///< Managed buffer.
+  uint32_t _size = 0;                              ///< Usable size of the buffer (multiple of min_block).
+  uint16_t _min_block = 0;                         ///< Smallest block size.
+  uint8_t _min_shift = 0;                          ///< Log2 of min_block.
+  uint8_t _orders = 0;                             ///< Number of block orders.
+  uint32_t _nonempty = 0;                          ///< Bit o set while the free list of order o is not empty.
+  uint32_t _free_bytes = 0;                        ///< Total size of the free blocks.
+  node* _free[MEMPOOL_BUDDY_MAX_ORDERS] = {};      ///< Free list heads per order.
+  uint32_t _map_offset[MEMPOOL_BUDDY_MAX_ORDERS];  ///< Offset of each order's bitmap in _map.
+  mempool_word* _map = nullptr;                    ///< Free block bitmaps of all orders.
+  uint8_t* _block_order = nullptr;  ///< Order of the block starting at each min_block, with 0x80 set while allocated.
+};
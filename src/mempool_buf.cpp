@@ -0,0 +1,285 @@
+#include "mempool_buf.h"
+
+#include <string.h>
+
+pool_buf::pool_buf(mempool& pool, uint16_t cell_size, uint16_t headroom)
+    : _pool(&pool), _cell_size(cell_size), _headroom(headroom) {}
+
+pool_buf::~pool_buf() {
+  clear();
+}
+
+pool_buf::pool_buf(pool_buf&& other)
+    : _pool(other._pool),
+      _cell_size(other._cell_size),
+      _headroom(other._headroom),
+      _segment(other._segment),
+      _head(other._head),
+      _tail(other._tail),
+      _length(other._length) {
+  other._head = nullptr;
+  other._tail = nullptr;
+  other._length = 0;
+}
+
+pool_buf& pool_buf::operator=(pool_buf&& other) {
+  if (this == &other) return *this;
+  clear();
+  _pool = other._pool;
+  _cell_size = other._cell_size;
+  _headroom = other._headroom;
+  _segment = other._segment;
+  _head = other._head;
+  _tail = other._tail;
+  _length = other._length;
+  other._head = nullptr;
+  other._tail = nullptr;
+  other._length = 0;
+  return *this;
+}
+
+void pool_buf::_resolve() {
+  if (_segment >= 0) return;
+  if (!_cell_size) _cell_size = _pool->max_segment_size();
+  _segment = _pool->segment_for(_cell_size);
+  if (_headroom >= _cell_size) _headroom = 0;
+  if (!_pool->enable_refcounts()) _segment = -1;
+}
+
+uint8_t* pool_buf::_new_cell() {
+  _resolve();
+  if (_segment < 0) return nullptr;
+  // Only segment and slab cells carry reference counts, so there is no fallback to other allocators
+  return _pool->alloc_from(_segment);
+}
+
+pool_buf_seg* pool_buf::_new_seg(uint8_t* cell, uint16_t off, uint16_t len) {
+  pool_buf_seg* s = _pool->alloc<pool_buf_seg>(1);
+  if (!s) return nullptr;
+  s->next = nullptr;
+  s->cell = cell;
+  s->off = off;
+  s->len = len;
+  return s;
+}
+
+void pool_buf::_free_seg(pool_buf_seg* s) {
+  _pool->release(s->cell);
+  _pool->release(s);
+}
+
+void pool_buf::clear() {
+  while (_head) {
+    pool_buf_seg* s = _head;
+    _head = s->next;
+    _free_seg(s);
+  }
+  _tail = nullptr;
+  _length = 0;
+}
+
+bool pool_buf::append(const void* data, uint16_t len) {
+  const uint8_t* src = static_cast<const uint8_t*>(data);
+  while (len) {
+    // Fill the free space after the last segment unless another buffer shares the cell
+    if (_tail && _tail->off + _tail->len < _cell_size && _exclusive(_tail->cell)) {
+      uint16_t room = _cell_size - _tail->off - _tail->len;
+      uint16_t n = len < room ? len : room;
+      memcpy(_tail->data() + _tail->len, src, n);
+      _tail->len += n;
+      _length += n;
+      src += n;
+      len -= n;
+      continue;
+    }
+    uint8_t* cell = _new_cell();
+    if (!cell) return false;
+    pool_buf_seg* s = _new_seg(cell, _head ? 0 : _headroom, 0);
+    if (!s) {
+      _pool->release(cell);
+      return false;
+    }
+    if (_tail) {
+      _tail->next = s;
+    } else {
+      _head = s;
+    }
+    _tail = s;
+  }
+  return true;
+}
+
+bool pool_buf::append(pool_buf& other) {
+  if (&other == this || other._pool != _pool) return false;
+  _resolve();
+  other._resolve();
+  if (other._cell_size != _cell_size) return false;
+  if (!other._head) return true;
+  if (_tail) {
+    _tail->next = other._head;
+  } else {
+    _head = other._head;
+  }
+  _tail = other._tail;
+  _length += other._length;
+  other._head = nullptr;
+  other._tail = nullptr;
+  other._length = 0;
+  return true;
+}
+
+uint8_t* pool_buf::prepend(uint16_t len) {
+  _resolve();
+  if (len == 0 || _segment < 0 || len > _cell_size) return nullptr;
+  if (_head && _head->off >= len && _exclusive(_head->cell)) {
+    _head->off -= len;
+    _head->len += len;
+    _length += len;
+    return _head->data();
+  }
+  // New cell holding the bytes at its end, so later prepends find headroom in front of them
+  uint8_t* cell = _new_cell();
+  if (!cell) return nullptr;
+  pool_buf_seg* s = _new_seg(cell, _cell_size - len, len);
+  if (!s) {
+    _pool->release(cell);
+    return nullptr;
+  }
+  s->next = _head;
+  _head = s;
+  if (!_tail) _tail = s;
+  _length += len;
+  return s->data();
+}
+
+void pool_buf::trim_front(uint32_t len) {
+  while (len && _head) {
+    pool_buf_seg* s = _head;
+    if (len < s->len) {
+      s->off += len;
+      s->len -= len;
+      _length -= len;
+      return;
+    }
+    len -= s->len;
+    _length -= s->len;
+    _head = s->next;
+    if (!_head) _tail = nullptr;
+    _free_seg(s);
+  }
+}
+
+void pool_buf::trim_back(uint32_t len) {
+  if (len >= _length) {
+    clear();
+    return;
+  }
+  uint32_t keep = _length - len;
+  pool_buf_seg* s = _head;
+  while (keep > s->len) {
+    keep -= s->len;
+    s = s->next;
+  }
+  s->len = keep;
+  pool_buf_seg* rest = s->next;
+  s->next = nullptr;
+  _tail = s;
+  _length -= len;
+  while (rest) {
+    pool_buf_seg* n = rest->next;
+    _free_seg(rest);
+    rest = n;
+  }
+}
+
+bool pool_buf::split(uint32_t at, pool_buf& tail) {
+  if (&tail == this || tail._pool != _pool || at > _length) return false;
+  tail.clear();
+  tail._cell_size = _cell_size;
+  tail._segment = _segment;
+  if (at == _length) return true;
+  if (at == 0) {
+    tail._head = _head;
+    tail._tail = _tail;
+    tail._length = _length;
+    _head = _tail = nullptr;
+    _length = 0;
+    return true;
+  }
+
+  pool_buf_seg* s = _head;
+  uint32_t pos = 0;
+  while (pos + s->len <= at) {
+    pos += s->len;
+    s = s->next;
+  }
+  pool_buf_seg* prev = nullptr;
+  for (pool_buf_seg* p = _head; p != s; p = p->next) prev = p;
+  uint16_t k = at - pos;
+  pool_buf_seg* first = s;
+  if (k) {
+    // The cell is cut in two: both halves reference it
+    first = _new_seg(s->cell, s->off + k, s->len - k);
+    if (!first) return false;
+    if (!_pool->retain(s->cell)) {
+      _pool->release(first);
+      return false;
+    }
+    first->next = s->next;
+    s->len = k;
+    s->next = nullptr;
+    prev = s;
+  } else {
+    prev->next = nullptr;
+  }
+  tail._head = first;
+  tail._tail = (_tail == s && k) ? first : _tail;
+  tail._length = _length - at;
+  _tail = prev;
+  _length = at;
+  return true;
+}
+
+bool pool_buf::share(pool_buf& out) const {
+  if (&out == this || out._pool != _pool) return false;
+  out.clear();
+  out._cell_size = _cell_size;
+  out._segment = _segment;
+  for (const pool_buf_seg* s = _head; s; s = s->next) {
+    pool_buf_seg* c = out._new_seg(s->cell, s->off, s->len);
+    if (!c) {
+      out.clear();
+      return false;
+    }
+    if (!_pool->retain(s->cell)) {
+      _pool->release(c);
+      out.clear();
+      return false;
+    }
+    if (out._tail) {
+      out._tail->next = c;
+    } else {
+      out._head = c;
+    }
+    out._tail = c;
+    out._length += s->len;
+  }
+  return true;
+}
+
+uint32_t pool_buf::copy_out(uint32_t offset, void* dst, uint32_t len) const {
+  uint8_t* d = static_cast<uint8_t*>(dst);
+  uint32_t copied = 0;
+  for (const pool_buf_seg* s = _head; s && copied < len; s = s->next) {
+    if (offset >= s->len) {
+      offset -= s->len;
+      continue;
+    }
+    uint32_t n = s->len - offset;
+    if (n > len - copied) n = len - copied;
+    memcpy(d + copied, s->data() + offset, n);
+    copied += n;
+    offset = 0;
+  }
+  return copied;
+}
@@ -0,0 +1,176 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mempool.h"
+
+/**
+ * @brief Segment of a pool_buf: a byte range inside one pool cell.
+ */
+struct pool_buf_seg {
+  pool_buf_seg* next;  ///< Next segment of the chain.
+  uint8_t* cell;       ///< Pool cell holding the bytes.
+  uint16_t off;        ///< Offset of the first byte from the start of the cell.
+  uint16_t len;        ///< Number of bytes.
+
+  /**
+   * @brief First byte of the segment.
+   */
+  uint8_t* data() const { return cell + off; }
+};
+
+/**
+ * @brief Zero-copy chained buffer built from cells of one mempool segment.
+ * @details The bytes live in a chain of segments, each a range of a pool cell. Appending fills the last cell and
+ *          takes new ones, prepending uses headroom in front of the first cell, and trimming, splitting and
+ *          sharing only move segment descriptors: cells shared by several buffers are reference counted by the
+ *          pool (mempool::retain, enabled on first use) and go back to it when the last buffer drops them.
+ *          Writers consume the chain segment by segment, so frames are never flattened into a contiguous copy.
+ * @note A buffer is not synchronized. Shared cells may be owned by buffers in different tasks, their reference
+ *       counts are kept under the pool mutex and a shared cell is never written to. Data cells are only taken
+ *       from the data segment and its slabs, never by spilling or from buddy, TLSF or upstream, so every cell
+ *       has a counter; a buffer fails to grow instead when they are exhausted.
+ */
+class pool_buf {
+ public:
+  /**
+   * @brief Constructor.
+   * @param pool Pool providing the cells and segment descriptors.
+   * @param cell_size Cell size of the segment used for data (0 selects max_segment_size()).
+   * @param headroom Bytes left free in front of the first appended byte, for later prepends.
+   */
+  explicit pool_buf(mempool& pool = mem, uint16_t cell_size = 0, uint16_t headroom = 0);
+
+  /**
+   * @brief Destructor, drops every segment.
+   */
+  ~pool_buf();
+
+  pool_buf(const pool_buf&) = delete;
+  pool_buf& operator=(const pool_buf&) = delete;
+
+  /**
+   * @brief Move constructor, takes over the chain.
+   */
+  pool_buf(pool_buf&& other);
+
+  /**
+   * @brief Move assignment, drops the current chain and takes over the other one.
+   */
+  pool_buf& operator=(pool_buf&& other);
+
+  /**
+   * @brief Copies bytes to the end of the buffer.
+   * @param data Bytes to append.
+   * @param len Number of bytes.
+   * @return True on success, false if the pool ran out of cells (the bytes appended so far are kept).
+   */
+  bool append(const void* data, uint16_t len);
+
+  /**
+   * @brief Moves the chain of another buffer of the same pool to the end of this one, without copying.
+   * @param other Buffer to append, left empty.
+   * @return True on success, false if the buffers use different pools or cell sizes.
+   */
+  bool append(pool_buf& other);
+
+  /**
+   * @brief Makes room for a header in front of the buffer.
+   * @param len Number of bytes (at most one cell).
+   * @return Pointer to len contiguous bytes at the front, to be filled by the caller, or nullptr on failure.
+   */
+  uint8_t* prepend(uint16_t len);
+
+  /**
+   * @brief Drops bytes from the front.
+   * @param len Number of bytes (the whole buffer at most).
+   */
+  void trim_front(uint32_t len);
+
+  /**
+   * @brief Drops bytes from the back.
+   * @param len Number of bytes (the whole buffer at most).
+   */
+  void trim_back(uint32_t len);
+
+  /**
+   * @brief Moves the bytes from an offset on into another buffer, sharing the cell cut in two.
+   * @param at Offset of the first byte to move.
+   * @param tail Buffer of the same pool receiving the bytes (its previous content is dropped).
+   * @return True on success, false if the offset is past the end, the pools differ or no descriptor is left.
+   */
+  bool split(uint32_t at, pool_buf& tail);
+
+  /**
+   * @brief Makes another buffer a zero-copy view of the same bytes.
+   * @param out Buffer of the same pool receiving the view (its previous content is dropped).
+   * @return True on success, false if the pools differ or no descriptor is left.
+   */
+  bool share(pool_buf& out) const;
+
+  /**
+   * @brief Copies bytes out of the chain.
+   * @param offset Offset of the first byte.
+   * @param dst Destination.
+   * @param len Maximum number of bytes.
+   * @return Number of bytes copied.
+   */
+  uint32_t copy_out(uint32_t offset, void* dst, uint32_t len) const;
+
+  /**
+   * @brief Calls f(const uint8_t* data, uint16_t len) for every segment, for scatter-gather writers.
+   */
+  template <typename F>
+  void for_each(F f) const {
+    for (const pool_buf_seg* s = _head; s; s = s->next) f(static_cast<const uint8_t*>(s->data()), s->len);
+  }
+
+  /**
+   * @brief First segment of the chain (nullptr when empty).
+   */
+  const pool_buf_seg* segments() const { return _head; }
+
+  /**
+   * @brief Number of bytes in the buffer.
+   */
+  uint32_t length() const { return _length; }
+
+  /**
+   * @brief Drops every segment and releases the cells no other buffer shares.
+   */
+  void clear();
+
+ private:
+  /**
+   * @brief Takes a data cell from the pool with a reference count of 1.
+   */
+  uint8_t* _new_cell();
+
+  /**
+   * @brief Whether this buffer holds the only reference to a cell, so it may write to it.
+   */
+  bool _exclusive(const uint8_t* cell) const { return _pool->ref_count(cell) == 1; }
+
+  /**
+   * @brief Allocates a segment descriptor.
+   */
+  pool_buf_seg* _new_seg(uint8_t* cell, uint16_t off, uint16_t len);
+
+  /**
+   * @brief Drops a segment descriptor and its cell reference.
+   */
+  void _free_seg(pool_buf_seg* s);
+
+  /**
+   * @brief Resolves the data segment and cell size on first use.
+   */
+  void _resolve();
+
+  mempool* _pool;                 ///< Pool providing cells and descriptors.
+  uint16_t _cell_size;            ///< Cell size of the data segment.
+  uint16_t _headroom;             ///< Headroom in front of the first appended byte.
+  int16_t _segment = -1;          ///< Data segment, -1 until resolved.
+  pool_buf_seg* _head = nullptr;  ///< First segment.
+  pool_buf_seg* _tail = nullptr;  ///< Last segment.
+  uint32_t _length = 0;           ///< Number of bytes.
+};
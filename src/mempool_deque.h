@@ -0,0 +1,407 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+#include <utility>
+
+#include "mempool.h"
+
+/**
+ * @brief Double-ended queue storing its elements in fixed blocks taken from a mempool.
+ * @tparam T Element type.
+ * @details Each block is one pool cell (or a cell span for blocks larger than any cell) holding a prev/next link
+ *          and as many elements as fit. Blocks are linked, not indexed, so growing at either end takes a block
+ *          and shrinking returns one: elements are never moved or copied and no block table is reallocated.
+ *          One emptied block is kept as a spare, so a queue oscillating around a block boundary does not
+ *          allocate on every push. Indexed access walks the blocks from the nearer end.
+ * @note A deque is not synchronized. Blocks start at cell boundaries, so T must not need a stricter alignment
+ *       than the cells of the block segment provide.
+ */
+template <typename T>
+class pool_deque {
+ public:
+  /**
+   * @brief Constructor.
+   * @param pool Pool providing the blocks.
+   * @param block_size Block size in bytes; sizes up to max_segment_size() use one cell of the fitting segment,
+   *        larger sizes a cell span (0 selects max_segment_size()).
+   */
+  explicit pool_deque(mempool& pool = mem, uint16_t block_size = 0) : _pool(pool), _block_size(block_size) {}
+
+  /**
+   * @brief Destructor, destroys the elements and returns every block.
+   */
+  ~pool_deque() {
+    clear();
+    shrink();
+  }
+
+  pool_deque(const pool_deque&) = delete;
+  pool_deque& operator=(const pool_deque&) = delete;
+
+  /**
+   * @brief Appends an element.
+   * @return True on success, false if the pool cannot provide a block.
+   */
+  bool push_back(const T& value) { return emplace_back(value); }
+
+  /**
+   * @brief Prepends an element.
+   * @return True on success, false if the pool cannot provide a block.
+   */
+  bool push_front(const T& value) { return emplace_front(value); }
+
+  /**
+   * @brief Constructs an element at the back.
+   * @return True on success, false if the pool cannot provide a block.
+   */
+  template <typename... Args>
+  bool emplace_back(Args&&... args);
+
+  /**
+   * @brief Constructs an element at the front.
+   * @return True on success, false if the pool cannot provide a block.
+   */
+  template <typename... Args>
+  bool emplace_front(Args&&... args);
+
+  /**
+   * @brief Destroys the last element (the deque must not be empty).
+   */
+  void pop_back();
+
+  /**
+   * @brief Destroys the first element (the deque must not be empty).
+   */
+  void pop_front();
+
+  /**
+   * @brief First element (the deque must not be empty).
+   */
+  T& front() const { return *_elem(_head, _first); }
+
+  /**
+   * @brief Last element (the deque must not be empty).
+   */
+  T& back() const { return *_elem(_tail, _last - 1); }
+
+  /**
+   * @brief Element at an index (index < size()).
+   */
+  T& operator[](uint32_t index) const;
+
+  /**
+   * @brief Calls f(T& value) for every element from front to back.
+   */
+  template <typename F>
+  void for_each(F f) const {
+    for (block* b = _head; b; b = b->next) {
+      uint16_t end = b == _tail ? _last : _per_block;
+      for (uint16_t i = b == _head ? _first : 0; i < end; i++) f(*_elem(b, i));
+    }
+  }
+
+  /**
+   * @brief Destroys every element and returns the blocks, keeping the spare.
+   */
+  void clear();
+
+  /**
+   * @brief Returns the spare block to the pool.
+   */
+  void shrink();
+
+  /**
+   * @brief Number of elements.
+   */
+  uint32_t size() const { return _size; }
+
+  /**
+   * @brief Whether the deque is empty.
+   */
+  bool empty() const { return _size == 0; }
+
+  /**
+   * @brief Number of elements per block, 0 until the first block is taken or if T does not fit a block.
+   */
+  uint16_t per_block() const { return _per_block; }
+
+ private:
+  /**
+   * @brief Link at the start of each block.
+   */
+  struct block {
+    block* prev;  ///< Block towards the front.
+    block* next;  ///< Block towards the back.
+  };
+
+  /// Offset of the first element from the start of a block.
+  static constexpr uint16_t _offset = (sizeof(block) + alignof(T) - 1) / alignof(T) * alignof(T);
+
+  /**
+   * @brief Element i of a block.
+   */
+  static T* _elem(block* b, uint16_t i) {
+    return reinterpret_cast<T*>(reinterpret_cast<uint8_t*>(b) + _offset) + i;
+  }
+
+  /**
+   * @brief Takes the spare block or a new one from the pool.
+   */
+  block* _take_block();
+
+  /**
+   * @brief Keeps an emptied block as the spare or returns it to the pool.
+   */
+  void _drop_block(block* b);
+
+  /**
+   * @brief Releases a block to the pool.
+   */
+  void _release_block(block* b);
+
+  mempool& _pool;             ///< Pool providing the blocks.
+  uint16_t _block_size;       ///< Block size in bytes, 0 until resolved.
+  int16_t _segment = -1;      ///< Segment of single-cell blocks, -1 for spans or until resolved.
+  uint16_t _per_block = 0;    ///< Elements per block.
+  block* _head = nullptr;     ///< Front block.
+  block* _tail = nullptr;     ///< Back block.
+  block* _spare = nullptr;    ///< Emptied block kept for reuse.
+  uint16_t _first = 0;        ///< Index of the front element in the front block.
+  uint16_t _last = 0;         ///< Index after the back element in the back block.
+  uint32_t _size = 0;         ///< Number of elements.
+};
+
+/**
+ * @brief Growable FIFO ring of samples over a pool_deque.
+ * @tparam T Element type.
+ * @details The ring grows block by block up to its limit and shrinks as it is drained, without moving the
+ *          stored samples. When the limit is reached, push either drops the oldest sample or fails.
+ * @note A ring is not synchronized.
+ */
+template <typename T>
+class pool_ring {
+ public:
+  /**
+   * @brief Constructor.
+   * @param pool Pool providing the blocks.
+   * @param max_size Maximum number of samples (0 for no limit other than the pool).
+   * @param overwrite Whether push drops the oldest sample when the ring is full.
+   * @param block_size Block size in bytes (see pool_deque).
+   */
+  explicit pool_ring(mempool& pool = mem, uint32_t max_size = 0, bool overwrite = true, uint16_t block_size = 0)
+      : _items(pool, block_size), _max_size(max_size), _overwrite(overwrite) {}
+
+  /**
+   * @brief Appends a sample.
+   * @return True on success, false if the ring is full without overwrite or the pool cannot provide a block.
+   */
+  bool push(const T& value) {
+    if (_max_size && _items.size() >= _max_size) {
+      if (!_overwrite) return false;
+      _items.pop_front();
+    }
+    return _items.push_back(value);
+  }
+
+  /**
+   * @brief Takes the oldest sample.
+   * @param out Receives the sample.
+   * @return True on success, false if the ring is empty.
+   */
+  bool pop(T& out) {
+    if (_items.empty()) return false;
+    out = std::move(_items.front());
+    _items.pop_front();
+    return true;
+  }
+
+  /**
+   * @brief Oldest sample (the ring must not be empty).
+   */
+  T& peek() const { return _items.front(); }
+
+  /**
+   * @brief Sample at an age index, 0 being the oldest (index < size()).
+   */
+  T& operator[](uint32_t index) const { return _items[index]; }
+
+  /**
+   * @brief Drops every sample.
+   */
+  void clear() { _items.clear(); }
+
+  /**
+   * @brief Number of samples.
+   */
+  uint32_t size() const { return _items.size(); }
+
+  /**
+   * @brief Whether the ring is empty.
+   */
+  bool empty() const { return _items.empty(); }
+
+  /**
+   * @brief Whether the ring holds max_size samples.
+   */
+  bool full() const { return _max_size && _items.size() >= _max_size; }
+
+ private:
+  pool_deque<T> _items;  ///< Stored samples.
+  uint32_t _max_size;    ///< Maximum number of samples, 0 for no limit.
+  bool _overwrite;       ///< Whether push drops the oldest sample when full.
+};
+
+template <typename T>
+typename pool_deque<T>::block* pool_deque<T>::_take_block() {
+  if (_spare) {
+    block* b = _spare;
+    _spare = nullptr;
+    return b;
+  }
+  if (!_per_block) {
+    if (!_block_size) _block_size = _pool.max_segment_size();
+    if (_block_size <= _offset || (_block_size - _offset) / sizeof(T) == 0) return nullptr;
+    _per_block = (_block_size - _offset) / sizeof(T);
+    _segment = _pool.segment_for(_block_size);
+  }
+  uint8_t* p;
+  if (_segment >= 0) {
+    p = _pool.alloc_from(_segment);
+    if (!p) p = _pool.alloc(_block_size);
+  } else {
+    p = _pool.alloc_span(_block_size);
+  }
+  return reinterpret_cast<block*>(p);
+}
+
+template <typename T>
+void pool_deque<T>::_release_block(block* b) {
+  if (_segment >= 0) {
+    _pool.release(reinterpret_cast<uint8_t*>(b), _block_size);
+  } else {
+    _pool.release_span(reinterpret_cast<uint8_t*>(b), _block_size);
+  }
+}
+
+template <typename T>
+void pool_deque<T>::_drop_block(block* b) {
+  if (_spare) {
+    _release_block(b);
+  } else {
+    _spare = b;
+  }
+}
+
+template <typename T>
+template <typename... Args>
+bool pool_deque<T>::emplace_back(Args&&... args) {
+  if (!_tail || _last == _per_block) {
+    block* b = _take_block();
+    if (!b) return false;
+    b->prev = _tail;
+    b->next = nullptr;
+    if (_tail) {
+      _tail->next = b;
+    } else {
+      _head = b;
+      _first = 0;
+    }
+    _tail = b;
+    _last = 0;
+  }
+  new (_elem(_tail, _last)) T(std::forward<Args>(args)...);
+  _last++;
+  _size++;
+  return true;
+}
+
+template <typename T>
+template <typename... Args>
+bool pool_deque<T>::emplace_front(Args&&... args) {
+  if (!_head || _first == 0) {
+    block* b = _take_block();
+    if (!b) return false;
+    b->prev = nullptr;
+    b->next = _head;
+    if (_head) {
+      _head->prev = b;
+    } else {
+      _tail = b;
+      _last = _per_block;
+    }
+    _head = b;
+    _first = _per_block;
+  }
+  new (_elem(_head, _first - 1)) T(std::forward<Args>(args)...);
+  _first--;
+  _size++;
+  return true;
+}
+
+template <typename T>
+void pool_deque<T>::pop_back() {
+  _last--;
+  _elem(_tail, _last)->~T();
+  _size--;
+  if (_size == 0) {
+    _drop_block(_tail);
+    _head = _tail = nullptr;
+  } else if (_last == 0) {
+    block* b = _tail;
+    _tail = b->prev;
+    _tail->next = nullptr;
+    _last = _per_block;
+    _drop_block(b);
+  }
+}
+
+template <typename T>
+void pool_deque<T>::pop_front() {
+  _elem(_head, _first)->~T();
+  _first++;
+  _size--;
+  if (_size == 0) {
+    _drop_block(_head);
+    _head = _tail = nullptr;
+  } else if (_first == _per_block) {
+    block* b = _head;
+    _head = b->next;
+    _head->prev = nullptr;
+    _first = 0;
+    _drop_block(b);
+  }
+}
+
+template <typename T>
+T& pool_deque<T>::operator[](uint32_t index) const {
+  if (index < _size / 2) {
+    uint32_t i = _first + index;
+    block* b = _head;
+    for (; i >= _per_block; i -= _per_block) b = b->next;
+    return *_elem(b, i);
+  }
+  // Walk back from the tail block for the second half
+  uint32_t back = _size - 1 - index;
+  uint32_t avail = _last;
+  block* b = _tail;
+  while (back >= avail) {
+    back -= avail;
+    b = b->prev;
+    avail = _per_block;
+  }
+  return *_elem(b, avail - 1 - back);
+}
+
+template <typename T>
+void pool_deque<T>::clear() {
+  while (_size) pop_back();
+}
+
+template <typename T>
+void pool_deque<T>::shrink() {
+  if (!_spare) return;
+  _release_block(_spare);
+  _spare = nullptr;
+}
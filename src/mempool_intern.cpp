@@ -0,0 +1,158 @@
+#include "mempool_intern.h"
+
+#include <string.h>
+
+pool_intern::pool_intern(mempool& pool) : _pool(pool) {
+  _mutex = xSemaphoreCreateMutex();
+}
+
+pool_intern::~pool_intern() {
+  clean();
+  if (_mutex) {
+    vSemaphoreDelete(_mutex);
+  }
+}
+
+bool pool_intern::begin(uint16_t capacity) {
+  if (_buckets || capacity == 0 || !_mutex) return false;
+  uint32_t n = 1;
+  while (n < capacity) n <<= 1;
+  if (n * sizeof(entry*) > 0xFFFF) return false;
+  _buckets = reinterpret_cast<entry**>(_pool.alloc_span_aligned(n * sizeof(entry*), alignof(entry*)));
+  _entries = reinterpret_cast<entry**>(_pool.alloc_span_aligned(capacity * sizeof(entry*), alignof(entry*)));
+  if (!_buckets || !_entries) {
+    if (_buckets) _pool.release_span(reinterpret_cast<uint8_t*>(_buckets), n * sizeof(entry*));
+    if (_entries) _pool.release_span(reinterpret_cast<uint8_t*>(_entries), capacity * sizeof(entry*));
+    _buckets = nullptr;
+    _entries = nullptr;
+    return false;
+  }
+  memset(_buckets, 0, n * sizeof(entry*));
+  memset(_entries, 0, capacity * sizeof(entry*));
+  _mask = n - 1;
+  _capacity = capacity;
+  _size = 0;
+  _next_handle = 0;
+  return true;
+}
+
+void pool_intern::clean() {
+  if (!_buckets) return;
+  for (uint16_t i = 0; i < _capacity; i++) {
+    if (_entries[i]) _pool.release(reinterpret_cast<uint8_t*>(_entries[i]));
+  }
+  _pool.release_span(reinterpret_cast<uint8_t*>(_buckets), (_mask + 1) * sizeof(entry*));
+  _pool.release_span(reinterpret_cast<uint8_t*>(_entries), _capacity * sizeof(entry*));
+  _buckets = nullptr;
+  _entries = nullptr;
+  _mask = 0;
+  _capacity = 0;
+  _size = 0;
+}
+
+uint32_t pool_intern::_hash(const char* str, uint16_t len) {
+  uint32_t h = 2166136261u;
+  for (uint16_t i = 0; i < len; i++) {
+    h ^= static_cast<uint8_t>(str[i]);
+    h *= 16777619u;
+  }
+  return h;
+}
+
+pool_intern::entry** pool_intern::_link(const char* str, uint8_t len, uint32_t hash) {
+  entry** link = &_buckets[hash & _mask];
+  // The stored hash rejects almost every other string before the characters are compared
+  while (*link && ((*link)->hash != hash || (*link)->len != len || memcmp((*link)->str, str, len) != 0)) {
+    link = &(*link)->next;
+  }
+  return link;
+}
+
+pool_str pool_intern::intern(const char* str, uint16_t len) {
+  if (!_buckets || !str || len > 0xFF) return MEMPOOL_NO_STRING;
+  uint32_t hash = _hash(str, len);
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return MEMPOOL_NO_STRING;
+  entry** link = _link(str, len, hash);
+  entry* e = *link;
+  if (e) {
+    pool_str id = e->refs < 0xFFFF ? e->id : MEMPOOL_NO_STRING;
+    if (id != MEMPOOL_NO_STRING) e->refs++;
+    xSemaphoreGive(_mutex);
+    return id;
+  }
+  if (_size >= _capacity) {
+    xSemaphoreGive(_mutex);
+    return MEMPOOL_NO_STRING;
+  }
+  e = reinterpret_cast<entry*>(_pool.alloc_aligned(offsetof(entry, str) + len + 1, alignof(entry)));
+  if (!e) {
+    xSemaphoreGive(_mutex);
+    return MEMPOOL_NO_STRING;
+  }
+  while (_entries[_next_handle]) _next_handle = _next_handle + 1 < _capacity ? _next_handle + 1 : 0;
+  _entries[_next_handle] = e;
+  e->next = nullptr;
+  e->hash = hash;
+  e->refs = 1;
+  e->id = _next_handle + 1;
+  e->len = len;
+  memcpy(e->str, str, len);
+  e->str[len] = '\0';
+  *link = e;
+  _size++;
+  xSemaphoreGive(_mutex);
+  return e->id;
+}
+
+pool_str pool_intern::intern(const char* str) {
+  if (!str) return MEMPOOL_NO_STRING;
+  size_t len = strlen(str);
+  return len > 0xFF ? MEMPOOL_NO_STRING : intern(str, static_cast<uint16_t>(len));
+}
+
+pool_str pool_intern::find(const char* str, uint16_t len) {
+  if (!_buckets || !str || len > 0xFF) return MEMPOOL_NO_STRING;
+  uint32_t hash = _hash(str, len);
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return MEMPOOL_NO_STRING;
+  entry* e = *_link(str, len, hash);
+  pool_str id = e ? e->id : MEMPOOL_NO_STRING;
+  xSemaphoreGive(_mutex);
+  return id;
+}
+
+bool pool_intern::retain(pool_str handle) {
+  if (!_buckets) return false;
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return false;
+  entry* e = _entry(handle);
+  bool ok = e && e->refs < 0xFFFF;
+  if (ok) e->refs++;
+  xSemaphoreGive(_mutex);
+  return ok;
+}
+
+void pool_intern::release(pool_str handle) {
+  if (!_buckets) return;
+  if (xSemaphoreTake(_mutex, portMAX_DELAY) != pdTRUE) return;
+  entry* e = _entry(handle);
+  if (!e || --e->refs) {
+    xSemaphoreGive(_mutex);
+    return;
+  }
+  entry** link = &_buckets[e->hash & _mask];
+  while (*link != e) link = &(*link)->next;
+  *link = e->next;
+  _entries[handle - 1] = nullptr;
+  _size--;
+  xSemaphoreGive(_mutex);
+  _pool.release(reinterpret_cast<uint8_t*>(e));
+}
+
+const char* pool_intern::str(pool_str handle) const {
+  entry* e = _buckets ? _entry(handle) : nullptr;
+  return e ? e->str : nullptr;
+}
+
+uint8_t pool_intern::length(pool_str handle) const {
+  entry* e = _buckets ? _entry(handle) : nullptr;
+  return e ? e->len : 0;
+}
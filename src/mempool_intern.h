@@ -0,0 +1,145 @@
+#pragma once
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mempool.h"
+
+#define MEMPOOL_NO_STRING 0  ///< Handle of no string.
+
+/**
+ * @brief Handle of an interned string: equal strings of one table have equal handles.
+ */
+typedef uint16_t pool_str;
+
+/**
+ * @brief Table of deduplicated short strings stored in pool cells.
+ * @details Each distinct string is stored once, in a pool cell holding a small header and the characters, and
+ *          is named by a 16-bit handle, so comparing two interned strings is comparing two integers. Lookups hash
+ *          the string (FNV-1a) into chained buckets; the bucket array and the handle table are cell spans of
+ *          the same pool. Entries and tables hold pointers, so they are allocated at pointer alignment. Strings are reference counted: every intern adds a reference and release drops one,
+ *          the cell going back to the pool with the last.
+ * @note The table is synchronized with its own mutex. The characters of a string stay valid while its
+ *       handle holds a reference.
+ */
+class pool_intern {
+ public:
+  /**
+   * @brief Constructor.
+   * @param pool Pool providing the string cells and tables.
+   */
+  explicit pool_intern(mempool& pool = mem);
+
+  /**
+   * @brief Destructor, returns every string and the tables to the pool.
+   */
+  ~pool_intern();
+
+  pool_intern(const pool_intern&) = delete;
+  pool_intern& operator=(const pool_intern&) = delete;
+
+  /**
+   * @brief Allocates the tables.
+   * @param capacity Maximum number of distinct strings.
+   * @return True on success, false if the table is already initialized, the capacity is 0 or too large for a
+   *         cell span, or the pool cannot provide the tables.
+   */
+  bool begin(uint16_t capacity);
+
+  /**
+   * @brief Returns every string and the tables to the pool.
+   */
+  void clean();
+
+  /**
+   * @brief Interns a string and adds a reference to it.
+   * @param str Characters (need not be null-terminated).
+   * @param len Number of characters (at most 255).
+   * @return Handle of the string, or MEMPOOL_NO_STRING if the table is full, the string is too long, its
+   *         reference count is saturated or the pool ran out of cells.
+   */
+  pool_str intern(const char* str, uint16_t len);
+
+  /**
+   * @brief Interns a null-terminated string and adds a reference to it.
+   */
+  pool_str intern(const char* str);
+
+  /**
+   * @brief Looks up a string without interning it or adding a reference.
+   * @return Handle of the string, or MEMPOOL_NO_STRING if it is not interned.
+   */
+  pool_str find(const char* str, uint16_t len);
+
+  /**
+   * @brief Adds a reference to an interned string.
+   * @return True on success, false for an invalid handle or a saturated reference count.
+   */
+  bool retain(pool_str handle);
+
+  /**
+   * @brief Drops a reference, removing the string with its last one.
+   */
+  void release(pool_str handle);
+
+  /**
+   * @brief Null-terminated characters of a string, nullptr for an invalid handle.
+   */
+  const char* str(pool_str handle) const;
+
+  /**
+   * @brief Number of characters of a string, 0 for an invalid handle.
+   */
+  uint8_t length(pool_str handle) const;
+
+  /**
+   * @brief Number of interned strings.
+   */
+  uint16_t size() const { return _size; }
+
+  /**
+   * @brief Maximum number of strings, 0 before begin.
+   */
+  uint16_t capacity() const { return _capacity; }
+
+ private:
+  /**
+   * @brief Pool cell of an interned string.
+   */
+  struct entry {
+    entry* next;    ///< Next entry of the bucket.
+    uint32_t hash;  ///< FNV-1a hash of the characters.
+    uint16_t refs;  ///< Number of references.
+    pool_str id;    ///< Handle.
+    uint8_t len;    ///< Number of characters.
+    char str[1];    ///< Null-terminated characters.
+  };
+
+  /**
+   * @brief Entry of a handle, nullptr if the handle is invalid.
+   */
+  entry* _entry(pool_str handle) const {
+    return handle != MEMPOOL_NO_STRING && handle <= _capacity ? _entries[handle - 1] : nullptr;
+  }
+
+  /**
+   * @brief Bucket link of a string.
+   * @return The link pointing to the string's entry, or to the null end of its bucket if absent.
+   */
+  entry** _link(const char* str, uint8_t len, uint32_t hash);
+
+  /**
+   * @brief FNV-1a hash of a string.
+   */
+  static uint32_t _hash(const char* str, uint16_t len);
+
+  mempool& _pool;                      ///< Pool providing cells and tables.
+  SemaphoreHandle_t _mutex = nullptr;  ///< Guards the buckets, the handle table and the counts.
+  entry** _buckets = nullptr;          ///< Bucket heads.
+  entry** _entries = nullptr;          ///< Entry of each handle - 1.
+  uint32_t _mask = 0;                  ///< Bucket count - 1.
+  uint16_t _capacity = 0;              ///< Maximum number of strings.
+  uint16_t _size = 0;                  ///< Number of strings.
+  uint16_t _next_handle = 0;           ///< Table index where the search for a free handle starts.
+};
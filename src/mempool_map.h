@@ -0,0 +1,246 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <new>
+#include <utility>
+
+#include "mempool.h"
+
+/**
+ * @brief Fixed-capacity hash map whose nodes and bucket array live in a mempool.
+ * @tparam K Key type.
+ * @tparam V Value type.
+ * @tparam Hash Hash function object for K.
+ * @tparam Eq Equality function object for K.
+ * @details Keys are chained per bucket. Nodes are pool cells of the segment fitting node_size(), so the segment
+ *          table can be planned with one cell per entry; the bucket array (one pointer per power-of-two bucket,
+ *          at least capacity of them) is a cell span of the same pool. The map never rehashes and never grows
+ *          past its capacity, so it never touches the general heap unless the pool falls back to upstream.
+ * @note A map is not synchronized. Nodes are created at alignof(node) and the bucket array is allocated at
+ *       pointer alignment, so the map also works in pools whose cell sizes are not multiples of 8; begin fails
+ *       rather than place the array in cells too loosely aligned for pointers.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+class pool_map {
+ private:
+  /**
+   * @brief Chained entry.
+   */
+  struct node {
+    node* next;  ///< Next node of the bucket.
+    K key;       ///< Key.
+    V value;     ///< Value.
+
+    template <typename... Args>
+    node(const K& k, Args&&... args) : next(nullptr), key(k), value(std::forward<Args>(args)...) {}
+  };
+
+ public:
+  /**
+   * @brief Constructor.
+   * @param pool Pool providing the nodes and the bucket array.
+   */
+  explicit pool_map(mempool& pool = mem) : _nodes(pool), _pool(pool) {}
+
+  /**
+   * @brief Destructor, destroys every entry and returns the bucket array.
+   */
+  ~pool_map() { clean(); }
+
+  pool_map(const pool_map&) = delete;
+  pool_map& operator=(const pool_map&) = delete;
+
+  /**
+   * @brief Allocates the bucket array.
+   * @param capacity Maximum number of entries.
+   * @return True on success, false if the capacity is 0, the map is already initialized or the pool cannot
+   *         provide the bucket array.
+   */
+  bool begin(uint16_t capacity);
+
+  /**
+   * @brief Destroys every entry and returns the bucket array to the pool.
+   */
+  void clean();
+
+  /**
+   * @brief Inserts a key or assigns the value of an existing one.
+   * @param key Key.
+   * @param value Value.
+   * @return Pointer to the stored value, or nullptr if the map is full or the pool ran out of cells.
+   */
+  V* insert(const K& key, const V& value);
+
+  /**
+   * @brief Constructs the value of a key if it is absent.
+   * @param key Key.
+   * @param args Constructor arguments of the value, used only when the key is inserted.
+   * @return Pointer to the stored value (the existing one if the key was present), or nullptr on failure.
+   */
+  template <typename... Args>
+  V* emplace(const K& key, Args&&... args);
+
+  /**
+   * @brief Looks up a key.
+   * @return Pointer to the value, or nullptr if the key is absent.
+   */
+  V* find(const K& key) const;
+
+  /**
+   * @brief Whether a key is present.
+   */
+  bool contains(const K& key) const { return find(key) != nullptr; }
+
+  /**
+   * @brief Removes a key.
+   * @return True if the key was present.
+   */
+  bool erase(const K& key);
+
+  /**
+   * @brief Removes every entry, keeping the bucket array.
+   */
+  void clear();
+
+  /**
+   * @brief Calls f(const K& key, V& value) for every entry, in no particular order.
+   */
+  template <typename F>
+  void for_each(F f) const {
+    for (uint32_t b = 0; b <= _mask && _buckets; b++) {
+      for (node* n = _buckets[b]; n; n = n->next) f(static_cast<const K&>(n->key), n->value);
+    }
+  }
+
+  /**
+   * @brief Number of entries.
+   */
+  uint16_t size() const { return _size; }
+
+  /**
+   * @brief Maximum number of entries, 0 before begin.
+   */
+  uint16_t capacity() const { return _capacity; }
+
+  /**
+   * @brief Size of one entry in the pool, for planning the segment table.
+   */
+  static constexpr uint16_t node_size() { return sizeof(node); }
+
+ private:
+  /**
+   * @brief Bucket link of a key.
+   * @return The link pointing to the key's node, or to the null end of its bucket if absent.
+   */
+  node** _link(const K& key) const;
+
+  typed_pool<node> _nodes;      ///< Node cells.
+  mempool& _pool;               ///< Pool providing the bucket array.
+  node** _buckets = nullptr;    ///< Bucket heads.
+  uint32_t _mask = 0;           ///< Bucket count - 1.
+  uint8_t _shift = 32;          ///< 32 - log2(bucket count), for Fibonacci hashing.
+  uint16_t _capacity = 0;       ///< Maximum number of entries.
+  uint16_t _size = 0;           ///< Number of entries.
+};
+
+template <typename K, typename V, typename Hash, typename Eq>
+bool pool_map<K, V, Hash, Eq>::begin(uint16_t capacity) {
+  if (_buckets || capacity == 0) return false;
+  uint32_t n = 1;
+  uint8_t bits = 0;
+  while (n < capacity) {
+    n <<= 1;
+    bits++;
+  }
+  if (n * sizeof(node*) > 0xFFFF) return false;
+  _buckets = reinterpret_cast<node**>(_pool.alloc_span_aligned(n * sizeof(node*), alignof(node*)));
+  if (!_buckets) return false;
+  for (uint32_t i = 0; i < n; i++) _buckets[i] = nullptr;
+  _mask = n - 1;
+  _shift = 32 - bits;
+  _capacity = capacity;
+  _size = 0;
+  return true;
+}
+
+template <typename K, typename V, typename Hash, typename Eq>
+void pool_map<K, V, Hash, Eq>::clean() {
+  if (!_buckets) return;
+  clear();
+  _pool.release_span(reinterpret_cast<uint8_t*>(_buckets), (_mask + 1) * sizeof(node*));
+  _buckets = nullptr;
+  _mask = 0;
+  _shift = 32;
+  _capacity = 0;
+}
+
+template <typename K, typename V, typename Hash, typename Eq>
+typename pool_map<K, V, Hash, Eq>::node** pool_map<K, V, Hash, Eq>::_link(const K& key) const {
+  // Fibonacci hashing spreads identity hashes of small integers over the high bits
+  uint32_t h = static_cast<uint32_t>(Hash()(key)) * 0x9E3779B9u;
+  node** link = &_buckets[_shift < 32 ? h >> _shift : 0];
+  while (*link && !Eq()((*link)->key, key)) link = &(*link)->next;
+  return link;
+}
+
+template <typename K, typename V, typename Hash, typename Eq>
+V* pool_map<K, V, Hash, Eq>::insert(const K& key, const V& value) {
+  if (!_buckets) return nullptr;
+  node** link = _link(key);
+  if (*link) {
+    (*link)->value = value;
+    return &(*link)->value;
+  }
+  if (_size >= _capacity) return nullptr;
+  node* n = _nodes.create(key, value);
+  if (!n) return nullptr;
+  *link = n;
+  _size++;
+  return &n->value;
+}
+
+template <typename K, typename V, typename Hash, typename Eq>
+template <typename... Args>
+V* pool_map<K, V, Hash, Eq>::emplace(const K& key, Args&&... args) {
+  if (!_buckets) return nullptr;
+  node** link = _link(key);
+  if (*link) return &(*link)->value;
+  if (_size >= _capacity) return nullptr;
+  node* n = _nodes.create(key, std::forward<Args>(args)...);
+  if (!n) return nullptr;
+  *link = n;
+  _size++;
+  return &n->value;
+}
+
+template <typename K, typename V, typename Hash, typename Eq>
+V* pool_map<K, V, Hash, Eq>::find(const K& key) const {
+  if (!_buckets) return nullptr;
+  node* n = *_link(key);
+  return n ? &n->value : nullptr;
+}
+
+template <typename K, typename V, typename Hash, typename Eq>
+bool pool_map<K, V, Hash, Eq>::erase(const K& key) {
+  if (!_buckets) return false;
+  node** link = _link(key);
+  node* n = *link;
+  if (!n) return false;
+  *link = n->next;
+  _nodes.destroy(n);
+  _size--;
+  return true;
+}
+
+template <typename K, typename V, typename Hash, typename Eq>
+void pool_map<K, V, Hash, Eq>::clear() {
+  for (uint32_t b = 0; b <= _mask && _buckets; b++) {
+    while (node* n = _buckets[b]) {
+      _buckets[b] = n->next;
+      _nodes.destroy(n);
+    }
+  }
+  _size = 0;
+}
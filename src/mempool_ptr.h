@@ -0,0 +1,66 @@
+#pragma once
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "mempool.h"
+#include "mempool_allocator.h"
+
+/**
+ * @brief Stateless deleter destroying an object made by mempool::create in a fixed pool.
+ * @tparam T Type of the object.
+ * @tparam Pool Pool the object was created in (the global pool by default).
+ * @details The pool is a template argument, so pool_unique_ptr is as small as a raw pointer.
+ */
+template <typename T, mempool* Pool = &mem>
+struct pool_deleter {
+  /**
+   * @brief Runs the destructor and releases the cell.
+   */
+  void operator()(T* ptr) const { Pool->destroy(ptr); }
+};
+
+/**
+ * @brief Unique pointer owning an object in a pool cell.
+ */
+template <typename T, mempool* Pool = &mem>
+using pool_unique_ptr = std::unique_ptr<T, pool_deleter<T, Pool>>;
+
+/**
+ * @brief Creates an object in a pool cell owned by a pool_unique_ptr.
+ * @tparam T Type of the object.
+ * @tparam Pool Pool providing the cell (the global pool by default).
+ * @param args Constructor arguments, perfectly forwarded.
+ * @return Owning pointer, empty if allocation fails.
+ */
+template <typename T, mempool* Pool = &mem, typename... Args>
+pool_unique_ptr<T, Pool> pool_make_unique(Args&&... args) {
+  static_assert(!std::is_array<T>::value, "pool_make_unique: arrays are not supported");
+  return pool_unique_ptr<T, Pool>(Pool->template create<T>(std::forward<Args>(args)...));
+}
+
+/**
+ * @brief Creates a shared object with its control block in the same pool block.
+ * @tparam T Type of the object.
+ * @param pool Pool providing the block.
+ * @param args Constructor arguments, perfectly forwarded.
+ * @return Shared pointer to the object.
+ * @details Uses std::allocate_shared with mempool_allocator, so the reference counts and the object take one
+ *          allocation and share cache lines. Blocks larger than max_segment_size() come from operator new.
+ */
+template <typename T, typename... Args>
+std::shared_ptr<T> pool_make_shared(mempool& pool, Args&&... args) {
+  static_assert(!std::is_array<T>::value, "pool_make_shared: arrays are not supported");
+  return std::allocate_shared<T>(mempool_allocator<T>(pool), std::forward<Args>(args)...);
+}
+
+/**
+ * @brief Creates a shared object in the global pool with a co-allocated control block.
+ * @tparam T Type of the object.
+ * @param args Constructor arguments, perfectly forwarded.
+ * @return Shared pointer to the object.
+ */
+template <typename T, typename... Args>
+std::shared_ptr<T> pool_make_shared(Args&&... args) {
+  return pool_make_shared<T>(mem, std::forward<Args>(args)...);
+}
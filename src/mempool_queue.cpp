@@ -0,0 +1,102 @@
+#include "mempool_queue.h"
+
+pool_queue::pool_queue(mempool& pool) : _pool(pool) {}
+
+pool_queue::~pool_queue() {
+  clear();
+  delete[] _slots;
+}
+
+bool pool_queue::begin(uint16_t capacity, bool multi_producer) {
+  if (_slots || capacity == 0 || capacity > 0x8000) return false;
+  uint32_t n = 1;
+  while (n < capacity) n <<= 1;
+  _slots = new slot[n];
+  if (!_slots) return false;
+  for (uint32_t i = 0; i < n; i++) {
+    _slots[i].seq.store(i, std::memory_order_relaxed);
+    _slots[i].cell = nullptr;
+  }
+  _mask = n - 1;
+  _multi = multi_producer;
+  _tail.store(0, std::memory_order_relaxed);
+  _head.store(0, std::memory_order_release);
+  return true;
+}
+
+bool pool_queue::push(void* cell) {
+  if (!_slots || !cell) return false;
+  uint32_t pos = _tail.load(std::memory_order_relaxed);
+  slot* s;
+  for (;;) {
+    s = &_slots[pos & _mask];
+    int32_t diff = static_cast<int32_t>(s->seq.load(std::memory_order_acquire) - pos);
+    // The slot still holds the cell pushed one lap earlier
+    if (diff < 0) return false;
+    if (diff > 0) {
+      pos = _tail.load(std::memory_order_relaxed);
+      continue;
+    }
+    if (!_multi) {
+      _tail.store(pos + 1, std::memory_order_relaxed);
+      break;
+    }
+    if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+  }
+  s->cell = cell;
+  s->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+void* pool_queue::pop() {
+  if (!_slots) return nullptr;
+  uint32_t pos = _head.load(std::memory_order_relaxed);
+  slot* s = &_slots[pos & _mask];
+  if (s->seq.load(std::memory_order_acquire) != pos + 1) return nullptr;
+  void* cell = s->cell;
+  // Free the slot for the producer one lap ahead
+  s->seq.store(pos + _mask + 1, std::memory_order_release);
+  _head.store(pos + 1, std::memory_order_relaxed);
+  return cell;
+}
+
+uint16_t pool_queue::pop_batch(void** out, uint16_t max) {
+  if (!_slots || !out) return 0;
+  uint32_t pos = _head.load(std::memory_order_relaxed);
+  uint16_t n = 0;
+  while (n < max) {
+    slot* s = &_slots[pos & _mask];
+    if (s->seq.load(std::memory_order_acquire) != pos + 1) break;
+    out[n++] = s->cell;
+    s->seq.store(pos + _mask + 1, std::memory_order_release);
+    pos++;
+  }
+  _head.store(pos, std::memory_order_relaxed);
+  return n;
+}
+
+void pool_queue::recycle(void* cell) {
+  if (!cell) return;
+  _recycled[_recycled_count++] = cell;
+  if (_recycled_count == MEMPOOL_QUEUE_BATCH) flush();
+}
+
+void pool_queue::flush() {
+  if (!_recycled_count) return;
+  _pool.release_batch(_recycled, _recycled_count);
+  _recycled_count = 0;
+}
+
+void pool_queue::clear() {
+  void* cells[MEMPOOL_QUEUE_BATCH];
+  uint16_t n;
+  while ((n = pop_batch(cells, MEMPOOL_QUEUE_BATCH)) > 0) _pool.release_batch(cells, n);
+  flush();
+}
+
+uint16_t pool_queue::size() const {
+  if (!_slots) return 0;
+  uint32_t head = _head.load(std::memory_order_acquire);
+  uint32_t n = _tail.load(std::memory_order_acquire) - head;
+  return n > _mask + 1 ? _mask + 1 : n;
+}
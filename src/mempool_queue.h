@@ -0,0 +1,114 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "mempool.h"
+
+#ifndef MEMPOOL_QUEUE_BATCH
+#define MEMPOOL_QUEUE_BATCH 16  ///< Cells gathered by pool_queue::recycle before they are returned to the pool.
+#endif
+
+/**
+ * @brief Lock-free queue passing ownership of pool cells between tasks.
+ * @details Producers fill a cell taken from the pool and push its pointer; the consumer pops it, so the payload
+ *          is never copied (xQueueSend would copy it by value). The ring is a bounded array of slots with
+ *          per-slot sequence numbers: a single producer publishes with one store, several producers claim
+ *          slots with a compare-and-swap, and the single consumer never blocks a producer. Cells the consumer
+ *          is done with can be gathered with recycle() and go back to the pool in batches with one pool lock.
+ * @note One task may pop at a time. push and pop never wait: a full queue fails push, an empty queue returns
+ *       nullptr, and waiting tasks are expected to use a task notification or poll. The ring comes from the
+ *       general heap and only holds pointers; producers pick the cells, so they must take them at the alignment
+ *       of their payload (alloc_aligned or typed_pool rather than plain alloc for 8-aligned types).
+ */
+class pool_queue {
+ public:
+  /**
+   * @brief Constructor.
+   * @param pool Pool the queued cells belong to, used by recycle, flush and clear.
+   */
+  explicit pool_queue(mempool& pool = mem);
+
+  /**
+   * @brief Destructor, releases the queued and gathered cells and the ring.
+   */
+  ~pool_queue();
+
+  pool_queue(const pool_queue&) = delete;
+  pool_queue& operator=(const pool_queue&) = delete;
+
+  /**
+   * @brief Allocates the ring.
+   * @param capacity Number of slots, rounded up to a power of 2 (at most 32768).
+   * @param multi_producer Whether several tasks push concurrently.
+   * @return True on success, false if the capacity is invalid or the ring cannot be allocated.
+   */
+  bool begin(uint16_t capacity, bool multi_producer = false);
+
+  /**
+   * @brief Passes a cell to the consumer.
+   * @param cell Cell allocated from the pool; its ownership moves to the queue.
+   * @return True on success, false if the queue is full or not initialized (the caller keeps the cell).
+   */
+  bool push(void* cell);
+
+  /**
+   * @brief Takes the oldest cell (consumer only).
+   * @return The cell, owned by the caller, or nullptr if the queue is empty.
+   */
+  void* pop();
+
+  /**
+   * @brief Takes up to max cells in order (consumer only).
+   * @param out Array receiving the cells.
+   * @param max Size of the array.
+   * @return Number of cells taken.
+   */
+  uint16_t pop_batch(void** out, uint16_t max);
+
+  /**
+   * @brief Hands a consumed cell back for a batched release (consumer only).
+   * @param cell Cell taken from the queue.
+   * @details Cells are released with mempool::release_batch once MEMPOOL_QUEUE_BATCH of them are gathered.
+   */
+  void recycle(void* cell);
+
+  /**
+   * @brief Releases the cells gathered by recycle.
+   */
+  void flush();
+
+  /**
+   * @brief Releases every queued and gathered cell (consumer only).
+   */
+  void clear();
+
+  /**
+   * @brief Number of queued cells; a snapshot while producers are active.
+   */
+  uint16_t size() const;
+
+  /**
+   * @brief Number of slots, 0 before begin.
+   */
+  uint16_t capacity() const { return _mask ? _mask + 1 : 0; }
+
+ private:
+  /**
+   * @brief Ring slot.
+   */
+  struct slot {
+    std::atomic<uint32_t> seq;  ///< Position the slot is ready for: pos when free, pos + 1 when filled.
+    void* cell;                 ///< Queued cell.
+  };
+
+  mempool& _pool;                  ///< Pool the cells belong to.
+  slot* _slots = nullptr;          ///< Ring of capacity slots.
+  uint32_t _mask = 0;              ///< Capacity - 1.
+  bool _multi = false;             ///< Whether producers claim slots with a compare-and-swap.
+  std::atomic<uint32_t> _tail{0};  ///< Next position to push.
+  std::atomic<uint32_t> _head{0};  ///< Next position to pop.
+  void* _recycled[MEMPOOL_QUEUE_BATCH];  ///< Cells gathered by recycle.
+  uint16_t _recycled_count = 0;          ///< Number of gathered cells.
+};
@@ -0,0 +1,89 @@
+#include "mempool_registry.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <string.h>
+
+#include "mempool.h"
+
+static mempool_range _ranges[MEMPOOL_REGISTRY_SIZE];  ///< Registered ranges sorted by start address.
+static uint8_t _range_count = 0;                       ///< Number of registered ranges.
+
+static SemaphoreHandle_t _registry_mutex() {
+  static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+  return mutex;
+}
+
+/**
+ * @brief Finds the last range starting at or before ptr. Must be called with the registry mutex held.
+ * @param ptr Address to look up.
+ * @return Index of the range, or -1 if every range starts after ptr.
+ */
+static int16_t _find_range(const uint8_t* ptr) {
+  int16_t ret = -1;
+  int16_t l = 0, r = _range_count - 1;
+  while (l <= r) {
+    int16_t m = (l + r) >> 1;
+    if (ptr < _ranges[m].start) {
+      r = m - 1;
+    } else {
+      ret = m;
+      l = m + 1;
+    }
+  }
+  return ret;
+}
+
+bool mempool_register(mempool* pool, const void* start, size_t size) {
+  if (!pool || !start || size == 0) return false;
+  const uint8_t* s = static_cast<const uint8_t*>(start);
+  if (xSemaphoreTake(_registry_mutex(), portMAX_DELAY) != pdTRUE) return false;
+  int16_t ix = _find_range(s);
+  bool ok = _range_count < MEMPOOL_REGISTRY_SIZE && (ix < 0 || _ranges[ix].end <= s) &&
+            (ix + 1 >= _range_count || s + size <= _ranges[ix + 1].start);
+  if (ok) {
+    memmove(&_ranges[ix + 2], &_ranges[ix + 1], (_range_count - ix - 1) * sizeof(mempool_range));
+    _ranges[ix + 1] = {s, s + size, pool};
+    _range_count++;
+  }
+  xSemaphoreGive(_registry_mutex());
+  return ok;
+}
+
+void mempool_unregister(const void* start) {
+  const uint8_t* s = static_cast<const uint8_t*>(start);
+  if (xSemaphoreTake(_registry_mutex(), portMAX_DELAY) != pdTRUE) return;
+  int16_t ix = _find_range(s);
+  if (ix >= 0 && _ranges[ix].start == s) {
+    memmove(&_ranges[ix], &_ranges[ix + 1], (_range_count - ix - 1) * sizeof(mempool_range));
+    _range_count--;
+  }
+  xSemaphoreGive(_registry_mutex());
+}
+
+void mempool_unregister_pool(mempool* pool) {
+  if (xSemaphoreTake(_registry_mutex(), portMAX_DELAY) != pdTRUE) return;
+  uint8_t j = 0;
+  for (uint8_t i = 0; i < _range_count; i++) {
+    if (_ranges[i].pool != pool) _ranges[j++] = _ranges[i];
+  }
+  _range_count = j;
+  xSemaphoreGive(_registry_mutex());
+}
+
+mempool* mempool_owner(const void* ptr) {
+  const uint8_t* p = static_cast<const uint8_t*>(ptr);
+  if (xSemaphoreTake(_registry_mutex(), portMAX_DELAY) != pdTRUE) return nullptr;
+  int16_t ix = _find_range(p);
+  mempool* pool = (ix >= 0 && p < _ranges[ix].end) ? _ranges[ix].pool : nullptr;
+  xSemaphoreGive(_registry_mutex());
+  return pool;
+}
+
+bool mempool_release_any(void* ptr) {
+  if (!ptr) return false;
+  mempool* pool = mempool_owner(ptr);
+  if (!pool) return false;
+  pool->release(static_cast<uint8_t*>(ptr));
+  return true;
+}
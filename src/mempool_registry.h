@@ -0,0 +1,60 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+class mempool;
+
+#ifndef MEMPOOL_REGISTRY_SIZE
+#define MEMPOOL_REGISTRY_SIZE 32  ///< Maximum number of address ranges in the pool registry.
+#endif
+
+/**
+ * @brief Address range owned by a registered pool.
+ */
+struct mempool_range {
+  const uint8_t* start;  ///< First byte of the range.
+  const uint8_t* end;    ///< One past the last byte of the range.
+  mempool* pool;         ///< Pool owning the range.
+};
+
+/**
+ * @brief Adds an address range to the pool registry.
+ * @details Pools register their buffer in begin() and each extra slab when it is added, so this is only
+ *          needed for memory handed to a pool by other means. Every region buffer, extra slab, buddy buffer
+ *          and TLSF buffer of every pool takes one of the MEMPOOL_REGISTRY_SIZE entries; a pool does not use
+ *          memory it cannot register, so begin(), set_buddy() and set_tlsf() fail and growth stops once the
+ *          registry is full.
+ * @param pool Pool owning the range.
+ * @param start First byte of the range.
+ * @param size Size of the range in bytes.
+ * @return True if the range was added, false if the registry is full or the range overlaps another one.
+ */
+bool mempool_register(mempool* pool, const void* start, size_t size);
+
+/**
+ * @brief Removes the range starting at the given address from the pool registry.
+ * @param start First byte of the range.
+ */
+void mempool_unregister(const void* start);
+
+/**
+ * @brief Removes every range owned by a pool from the pool registry.
+ * @param pool Pool whose ranges are removed.
+ */
+void mempool_unregister_pool(mempool* pool);
+
+/**
+ * @brief Finds the pool owning an address with a binary search over the sorted range table.
+ * @param ptr Address to look up.
+ * @return Owning pool, or nullptr if no registered range contains ptr.
+ */
+mempool* mempool_owner(const void* ptr);
+
+/**
+ * @brief Releases a pool cell without knowing which pool it came from.
+ * @param ptr Pointer returned by alloc of any registered pool.
+ * @return True if an owning pool was found and released the cell, false otherwise.
+ * @note Blocks served by a pool's upstream allocator are not in the registry and must be released
+ *       through their pool.
+ */
+bool mempool_release_any(void* ptr);
@@ -0,0 +1,19 @@
+#include "mempool_resource.h"
+
+#ifdef MEMPOOL_HAS_PMR
+void* mempool_resource::do_allocate(size_t bytes, size_t alignment) {
+  // The alignment selects an aligned segment up front, so no block is taken and handed back
+  if (bytes <= _pool.max_segment_size() && alignment <= MEMPOOL_ALIGN) {
+    uint8_t* p = _pool.alloc_pooled(bytes ? bytes : 1, alignment);
+    if (p) return p;
+  }
+  return _upstream->allocate(bytes, alignment);
+}
+
+void mempool_resource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+  if (bytes > _pool.max_segment_size() || alignment > MEMPOOL_ALIGN ||
+      !_pool.release_pooled(static_cast<uint8_t*>(p), bytes ? bytes : 1, alignment)) {
+    _upstream->deallocate(p, bytes, alignment);
+  }
+}
+#endif
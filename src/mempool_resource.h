@@ -0,0 +1,52 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mempool.h"
+
+#if defined(__has_include)
+#if __has_include(<memory_resource>) && __cplusplus >= 201703L
+#include <memory_resource>
+#define MEMPOOL_HAS_PMR 1  ///< Defined when std::pmr::memory_resource is available.
+#endif
+#endif
+
+#ifdef MEMPOOL_HAS_PMR
+/**
+ * @brief std::pmr::memory_resource backed by a mempool.
+ * @details Requests up to max_segment_size() are served by alloc_pooled (segments, buddy, TLSF), which picks a
+ *          segment meeting the requested alignment before allocating; other requests go to the upstream resource.
+ *          do_deallocate passes the size to release_pooled, which skips the segment search for blocks that were
+ *          not spilled.
+ */
+class mempool_resource : public std::pmr::memory_resource {
+ public:
+  /**
+   * @brief Constructor.
+   * @param pool Pool serving the allocations (the global pool by default).
+   * @param upstream Resource for oversize and unserved requests (the default resource by default).
+   */
+  explicit mempool_resource(mempool& pool = mem,
+                            std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+      : _pool(pool), _upstream(upstream) {}
+
+  /**
+   * @brief Pool serving the allocations.
+   */
+  mempool& pool() const { return _pool; }
+
+  /**
+   * @brief Resource serving the requests the pool cannot.
+   */
+  std::pmr::memory_resource* upstream_resource() const { return _upstream; }
+
+ protected:
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+ private:
+  mempool& _pool;                        ///< Pool serving the allocations.
+  std::pmr::memory_resource* _upstream;  ///< Resource for oversize and unserved requests.
+};
+#endif
@@ -0,0 +1,165 @@
+#include "mempool_tlsf.h"
+
+mempool_tlsf::~mempool_tlsf() {
+  clean();
+}
+
+void mempool_tlsf::clean() {
+  if (_sl_map) delete[] _sl_map;
+  if (_heads) delete[] _heads;
+  _sl_map = nullptr;
+  _heads = nullptr;
+  _buffer = nullptr;
+  _size = 0;
+  _fl_count = 0;
+  _fl_map = 0;
+  _free_bytes = 0;
+}
+
+bool mempool_tlsf::begin(uint8_t* buffer, uint32_t size) {
+  clean();
+  if (!buffer) return false;
+  // Align the start and the length, the last header is a used end sentinel of size 0
+  uint32_t skip = (ALIGN - (reinterpret_cast<uintptr_t>(buffer) & (ALIGN - 1))) & (ALIGN - 1);
+  if (size < skip + MIN_BLOCK + HEADER) return false;
+  uint32_t usable = (size - skip) & ~static_cast<uint32_t>(ALIGN - 1);
+  size_t first_size = usable - HEADER;
+
+  uint8_t fl, sl;
+  _mapping(first_size, fl, sl);
+  _fl_count = fl + 1;
+  _sl_map = new uint32_t[_fl_count]{};
+  if (!_sl_map) {
+    clean();
+    return false;
+  }
+  _heads = new block*[_fl_count * SL_COUNT]{};
+  if (!_heads) {
+    clean();
+    return false;
+  }
+  _buffer = buffer + skip;
+  _size = usable;
+
+  block* first = reinterpret_cast<block*>(_buffer);
+  first->prev_phys = nullptr;
+  first->size = first_size | 1;
+  block* sentinel = _next(first);
+  sentinel->prev_phys = first;
+  sentinel->size = 0;
+  _insert(first);
+  return true;
+}
+
+void mempool_tlsf::_mapping(size_t size, uint8_t& fl, uint8_t& sl) {
+  if (size < (static_cast<size_t>(1) << FL_SHIFT)) {
+    // Small blocks are spread linearly over the lists of class 0
+    fl = 0;
+    sl = size >> ALIGN_LOG2;
+  } else {
+    uint8_t f = _fls(size);
+    sl = (size >> (f - MEMPOOL_TLSF_SL_LOG2)) ^ SL_COUNT;
+    fl = f - FL_SHIFT + 1;
+  }
+}
+
+uint8_t* mempool_tlsf::alloc(uint32_t size) {
+  if (!_buffer || size == 0 || size > _size) return nullptr;
+  size_t need = (size + HEADER + ALIGN - 1) & ~(ALIGN - 1);
+  if (need < MIN_BLOCK) need = MIN_BLOCK;
+
+  // Round up to the next list boundary so any block of the found list fits (good fit)
+  size_t search = need;
+  if (search >= (static_cast<size_t>(1) << FL_SHIFT)) {
+    search += (static_cast<size_t>(1) << (_fls(search) - MEMPOOL_TLSF_SL_LOG2)) - 1;
+  }
+  uint8_t fl, sl;
+  _mapping(search, fl, sl);
+  if (fl >= _fl_count) return nullptr;
+  uint32_t sl_bits = _sl_map[fl] & (~0u << sl);
+  if (!sl_bits) {
+    uint32_t fl_bits = _fl_map & (~0u << (fl + 1));
+    if (!fl_bits) return nullptr;
+    fl = __builtin_ctz(fl_bits);
+    sl_bits = _sl_map[fl];
+  }
+  sl = __builtin_ctz(sl_bits);
+  block* b = _heads[fl * SL_COUNT + sl];
+  _remove(b);
+
+  // Split off the tail when it can hold a free block of its own
+  size_t bsize = b->size & ~static_cast<size_t>(1);
+  if (bsize - need >= MIN_BLOCK) {
+    block* rest = reinterpret_cast<block*>(reinterpret_cast<uint8_t*>(b) + need);
+    rest->prev_phys = b;
+    rest->size = (bsize - need) | 1;
+    _next(rest)->prev_phys = rest;
+    _insert(rest);
+    bsize = need;
+  }
+  b->size = bsize;
+  return reinterpret_cast<uint8_t*>(b) + HEADER;
+}
+
+bool mempool_tlsf::release(uint8_t* ptr) {
+  if (!owns(ptr)) return false;
+  if (ptr < _buffer + HEADER) return true;
+  block* b = reinterpret_cast<block*>(ptr - HEADER);
+  if (b->size & 1) return true;
+  b->size |= 1;
+
+  // Merge with the free physical neighbours
+  block* next = _next(b);
+  if (next->size & 1) {
+    _remove(next);
+    b->size += next->size & ~static_cast<size_t>(1);
+    _next(b)->prev_phys = b;
+  }
+  block* prev = b->prev_phys;
+  if (prev && (prev->size & 1)) {
+    _remove(prev);
+    prev->size += b->size & ~static_cast<size_t>(1);
+    _next(prev)->prev_phys = prev;
+    b = prev;
+  }
+  _insert(b);
+  return true;
+}
+
+uint32_t mempool_tlsf::block_size(const uint8_t* ptr) const {
+  if (!owns(ptr) || ptr < _buffer + HEADER) return 0;
+  const block* b = reinterpret_cast<const block*>(ptr - HEADER);
+  return (b->size & 1) ? 0 : b->size - HEADER;
+}
+
+void mempool_tlsf::_insert(block* b) {
+  uint8_t fl, sl;
+  size_t size = b->size & ~static_cast<size_t>(1);
+  _mapping(size, fl, sl);
+  block*& head = _heads[fl * SL_COUNT + sl];
+  b->prev_free = nullptr;
+  b->next_free = head;
+  if (head) head->prev_free = b;
+  head = b;
+  _sl_map[fl] |= 1u << sl;
+  _fl_map |= 1u << fl;
+  _free_bytes += size;
+}
+
+void mempool_tlsf::_remove(block* b) {
+  uint8_t fl, sl;
+  size_t size = b->size & ~static_cast<size_t>(1);
+  _mapping(size, fl, sl);
+  block*& head = _heads[fl * SL_COUNT + sl];
+  if (b->prev_free) {
+    b->prev_free->next_free = b->next_free;
+  } else {
+    head = b->next_free;
+  }
+  if (b->next_free) b->next_free->prev_free = b->prev_free;
+  if (!head) {
+    _sl_map[fl] &= ~(1u << sl);
+    if (!_sl_map[fl]) _fl_map &= ~(1u << fl);
+  }
+  _free_bytes -= size;
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MEMPOOL_TLSF_SL_LOG2
+#define MEMPOOL_TLSF_SL_LOG2 4  ///< Log2 of the number of second-level lists per power of two (at most 5).
+#endif
+
+/**
+ * @brief Two-Level Segregated Fit allocator for variable-size blocks carved from one buffer.
+ * @details Free blocks are kept in segregated lists indexed by a first level (power of two of the size) and a
+ *          second level (2^MEMPOOL_TLSF_SL_LOG2 linear steps within it), each level summarized by a bitmap. A
+ *          fitting list is found with two bit scans and a released block is merged with its physical
+ *          neighbours through boundary tags, so alloc and release run in constant worst-case time.
+ * @note The allocator is not synchronized; mempool calls it with its own mutex held.
+ */
+class mempool_tlsf {
+ public:
+  /**
+   * @brief Destructor, frees the list heads. The buffer itself belongs to the caller.
+   */
+  ~mempool_tlsf();
+
+  /**
+   * @brief Initializes the allocator over a buffer.
+   * @param buffer Memory to carve blocks from.
+   * @param size Size of the buffer in bytes.
+   * @return True if initialization succeeds, false otherwise.
+   */
+  bool begin(uint8_t* buffer, uint32_t size);
+
+  /**
+   * @brief Frees the list heads and detaches the buffer.
+   */
+  void clean();
+
+  /**
+   * @brief Allocates a block of at least size bytes in constant time.
+   * @param size Requested size in bytes.
+   * @return Pointer to the block, or nullptr if no free block is large enough.
+   */
+  uint8_t* alloc(uint32_t size);
+
+  /**
+   * @brief Releases a block and merges it with its free neighbours in constant time.
+   * @param ptr Pointer returned by alloc.
+   * @return True if ptr lies in the buffer (blocks that are already free are ignored), false otherwise.
+   */
+  bool release(uint8_t* ptr);
+
+  /**
+   * @brief Checks whether a pointer lies in the buffer.
+   */
+  bool owns(const uint8_t* ptr) const { return _buffer && ptr >= _buffer && ptr < _buffer + _size; }
+
+  /**
+   * @brief Usable size of an allocated block.
+   * @param ptr Pointer returned by alloc.
+   * @return Usable size in bytes, or 0 if ptr is outside the buffer or the block is free.
+   */
+  uint32_t block_size(const uint8_t* ptr) const;
+
+  /**
+   * @brief Total size of the free blocks in bytes, headers included.
+   */
+  uint32_t free_bytes() const { return _free_bytes; }
+
+ private:
+  /**
+   * @brief Block header. The free list links overlay the payload and are only valid in free blocks.
+   */
+  struct block {
+    block* prev_phys;  ///< Physically preceding block, nullptr for the first one.
+    size_t size;       ///< Block size including the header, bit 0 set while free.
+    block* next_free;  ///< Next block in the same free list.
+    block* prev_free;  ///< Previous block in the same free list.
+  };
+
+  static const uint8_t SL_COUNT = 1 << MEMPOOL_TLSF_SL_LOG2;                    ///< Second-level lists.
+  static const size_t ALIGN = 2 * sizeof(void*);                                ///< Block alignment.
+  static const uint8_t ALIGN_LOG2 = sizeof(void*) == 8 ? 4 : 3;                 ///< Log2 of ALIGN.
+  static const uint8_t FL_SHIFT = MEMPOOL_TLSF_SL_LOG2 + ALIGN_LOG2;            ///< Log2 of the first linear class.
+  static const size_t HEADER = offsetof(block, next_free);                      ///< Bytes in front of the payload.
+  static const size_t MIN_BLOCK = (sizeof(block) + ALIGN - 1) & ~(ALIGN - 1);  ///< Smallest block.
+
+  /**
+   * @brief Index of the highest set bit (v must not be 0).
+   */
+  static uint8_t _fls(size_t v) {
+    return sizeof(size_t) == 8 ? 63 - __builtin_clzll(v) : 31 - __builtin_clz(static_cast<uint32_t>(v));
+  }
+
+  /**
+   * @brief Maps a block size to its free list.
+   */
+  static void _mapping(size_t size, uint8_t& fl, uint8_t& sl);
+
+  /**
+   * @brief Adds a free block to its list and sets the bitmap bits.
+   */
+  void _insert(block* b);
+
+  /**
+   * @brief Removes a free block from its list and clears emptied bitmap bits.
+   */
+  void _remove(block* b);
+
+  /**
+   * @brief Block following b in memory (the end sentinel for the last block).
+   */
+  static block* _next(block* b) { return reinterpret_cast<block*>(reinterpret_cast<uint8_t*>(b) + (b->size & ~1)); }
+
+  uint8_t* _buffer = nullptr;   ///< Managed buffer.
+  uint32_t _size = 0;           ///< Size of the managed buffer.
+  uint8_t _fl_count = 0;        ///< Number of first-level classes.
+  uint32_t _fl_map = 0;         ///< Bit f set while first-level class f has a free block.
+  uint32_t* _sl_map = nullptr;  ///< Per first-level class, bit s set while list (f, s) is not empty.
+  block** _heads = nullptr;     ///< Free list heads, indexed f * SL_COUNT + s.
+  uint32_t _free_bytes = 0;     ///< Total size of the free blocks.
+};